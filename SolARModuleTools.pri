@@ -13,6 +13,7 @@ interfaces/SolARKeyframeSelector.h \
 interfaces/SolARBasicSink.h \
 interfaces/SolARBasicSource.h \
 interfaces/SolARPointCloudManager.h \
+interfaces/SolARSharedStorage.h \
 interfaces/SolARKeyframesManager.h \
 interfaces/SolARCovisibilityGraph.h \
 interfaces/SolARBoostCovisibilityGraph.h \
@@ -24,7 +25,10 @@ interfaces/SolARFiducialMarkerPoseEstimator.h \
 interfaces/SolARSLAMBootstrapper.h \
 interfaces/SolARSLAMTracking.h \
 interfaces/SolARSLAMMapping.h \
-interfaces/SolAROverlapDetector.h
+interfaces/SolAROverlapDetector.h \
+interfaces/SolARMapMaintenanceScheduler.h \
+interfaces/SolARStageProfiler.h \
+interfaces/SolARDescriptorDistance.h
 
 
 SOURCES += src/SolARImage2WorldMapper4Marker2D.cpp \
@@ -52,4 +56,7 @@ SOURCES += src/SolARImage2WorldMapper4Marker2D.cpp \
     src/SolARSLAMBootstrapper.cpp \
     src/SolARSLAMTracking.cpp \
     src/SolARSLAMMapping.cpp \
-    src/SolAROverlapDetector.cpp
+    src/SolAROverlapDetector.cpp \
+    src/SolARMapMaintenanceScheduler.cpp \
+    src/SolARStageProfiler.cpp \
+    src/SolARDescriptorDistance.cpp
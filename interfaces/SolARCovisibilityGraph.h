@@ -18,9 +18,12 @@
 #define SOLARCOVISIBILITYGRAPH_H
 
 #include "api/storage/ICovisibilityGraph.h"
-#include "xpcf/component/ComponentBase.h"
+#include "xpcf/component/ConfigurableBase.h"
 #include "SolARToolsAPI.h"
 #include <fstream>
+#include <atomic>
+#include <functional>
+#include <shared_mutex>
 #include <core/SerializationDefinitions.h>
 
 namespace SolAR {
@@ -29,10 +32,42 @@ namespace TOOLS {
 /**
  * @class SolARCovisibilityGraph
  * @brief A storage component to store with persistence the visibility between keypoints and 3D points, and respectively, based on a bimap from boost.
+ *
+ * <TT>UUID: 17c7087f-3394-4b4b-8e6d-3f8639bb00ea</TT>
+ *
+ * The graph can be sparsified: each node keeps at most maxNbNeighbors strongest edges plus all edges whose weight is greater
+ * than or equal to strongEdgeWeight. An edge is dropped only if it belongs to the strongest edges of none of its two nodes.
+ * Nodes exceeding the limit are only marked when an edge is created, and their weak edges are dropped by compact().
+ *
+ * The weights are atomic: when atomicWeightUpdates is enabled, increasing or decreasing an existing edge only takes
+ * the shared lock, the exclusive lock being reserved to the creation and the removal of edges and nodes.
+ *
+ * @SolARComponentPropertiesBegin
+ * @SolARComponentProperty{ maxNbNeighbors,
+ *                          maximum number of strongest edges kept per node (0 = no limit),
+ *                          @SolARComponentPropertyDescNum{ int, [0..MAX INT], 0 }}
+ * @SolARComponentProperty{ strongEdgeWeight,
+ *                          edges with a weight greater than or equal to this threshold are never dropped,
+ *                          @SolARComponentPropertyDescNum{ float, [0..MAX FLOAT], 30.f }}
+ * @SolARComponentProperty{ compactionPendingNodes,
+ *                          number of marked nodes from which the compaction is automatically run by increaseEdge (0 = only explicit compaction),
+ *                          @SolARComponentPropertyDescNum{ int, [0..MAX INT], 0 }}
+ * @SolARComponentProperty{ atomicWeightUpdates,
+ *                          update the weight of an existing edge without the exclusive lock (0 or 1),
+ *                          @SolARComponentPropertyDescNum{ int, [0..1], 1 }}
+ * @SolARComponentPropertiesEnd
+ *
  */
-class SOLAR_TOOLS_EXPORT_API SolARCovisibilityGraph : public org::bcom::xpcf::ComponentBase,
+class SOLAR_TOOLS_EXPORT_API SolARCovisibilityGraph : public org::bcom::xpcf::ConfigurableBase,
         public api::storage::ICovisibilityGraph {
 public:
+	/// @brief Statistics of the edge sparsification
+	struct CompactionStatistics {
+		uint64_t nbCompactions = 0;		///< number of compactions run
+		uint64_t nbCompactedNodes = 0;	///< number of nodes processed by the compactions
+		uint64_t nbRemovedEdges = 0;	///< number of weak edges dropped
+		size_t nbPendingNodes = 0;		///< number of nodes waiting for compaction
+	};
 
     SolARCovisibilityGraph();
     ~SolARCovisibilityGraph() = default;
@@ -119,12 +154,48 @@ public:
 	/// @return FrameworkReturnCode::_SUCCESS_ if the suppression succeed, else FrameworkReturnCode::_ERROR.
 	FrameworkReturnCode loadFromFile(const std::string& file) override;
     
+	/// @brief This method drops the weak edges of the nodes exceeding the maximum number of neighbors
+	/// @param[in] maxNbNodes the maximum number of nodes to compact, the other ones remain pending (0 = all nodes)
+	/// @return FrameworkReturnCode::_SUCCESS_ if the compaction succeed, else FrameworkReturnCode::_ERROR.
+	FrameworkReturnCode compact(const uint32_t maxNbNodes = 0);
+
+	/// @brief This method renumbers the nodes of the graph, the nodes without a new id are removed with their edges
+	/// @param[in] idMap the new id of each node
+	/// @return FrameworkReturnCode::_SUCCESS_ if the renumbering succeed, else FrameworkReturnCode::_ERROR.
+	FrameworkReturnCode renumber(const std::map<uint32_t, uint32_t> &idMap);
+
+	/// @brief This method allows to get the statistics of the edge sparsification
+	/// @return the compaction statistics
+	CompactionStatistics getCompactionStatistics() const;
+
+	/// @brief This method takes a copy of the graph
+	/// @return a function saving the copy to a file, it can be called from another thread
+	std::function<FrameworkReturnCode(const std::string&)> getSnapshotSaver() const;
+
 	void unloadComponent () override final;
 
+ private:
+	/// @brief get the maxNbNeighbors strongest neighbors of a node
+	void getStrongestNeighbors(const uint32_t node_id, std::set<uint32_t> &strongestNeighbors) const;
+
+	/// @brief drop the weak edges of a node which are not among the strongest ones of their nodes
+	/// @return the number of dropped edges
+	uint32_t compactNode(const uint32_t node_id, std::map<uint32_t, std::set<uint32_t>> &strongestNeighbors);
+
+	/// @brief compact the pending nodes, at most maxNbNodes if it is not 0 (the lock must be held)
+	void compactPendingNodes(const uint32_t maxNbNodes = 0);
+
  private:
 	 std::set<uint32_t>						m_nodes;
 	 std::map<uint32_t, std::set<uint32_t>> m_edges;
-	 std::map<uint64_t, float>				m_weights;
+	 std::map<uint64_t, std::atomic<float>>	m_weights;
+	 std::set<uint32_t>						m_pendingNodes;
+	 CompactionStatistics					m_compactionStats;
+	 int									m_maxNbNeighbors = 0;
+	 float									m_strongEdgeWeight = 30.f;
+	 int									m_compactionPendingNodes = 0;
+	 int									m_atomicWeightUpdates = 1;
+	 mutable std::shared_mutex				m_mutex;
 };
 
 }
@@ -0,0 +1,45 @@
+/**
+ * @copyright Copyright (c) 2017 B-com http://www.b-com.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SOLARDESCRIPTORDISTANCE_H
+#define SOLARDESCRIPTORDISTANCE_H
+
+#include "datastructure/DescriptorBuffer.h"
+#include "SolARToolsAPI.h"
+
+namespace SolAR {
+namespace MODULES {
+namespace TOOLS {
+
+/// @brief Compute the distance between two descriptors of descriptor buffers
+/// The distance is the Hamming distance for binary descriptors and the L2 distance otherwise, in the unit of the matchers.
+/// A normalized distance is in [0, 1]: it is divided by the number of bits for binary descriptors, by the sum of the norms
+/// of the descriptors otherwise.
+/// @param[in] descriptors1 the buffer of the first descriptor
+/// @param[in] index1 the index of the first descriptor in its buffer
+/// @param[in] descriptors2 the buffer of the second descriptor
+/// @param[in] index2 the index of the second descriptor in its buffer
+/// @param[in] normalized true to get the normalized distance
+/// @return the distance, the largest one if the descriptors cannot be compared
+SOLAR_TOOLS_EXPORT_API float descriptorDistance(const SRef<datastructure::DescriptorBuffer> &descriptors1, const uint32_t index1,
+												const SRef<datastructure::DescriptorBuffer> &descriptors2, const uint32_t index2, const bool normalized);
+
+}
+}
+}
+
+#endif // SOLARDESCRIPTORDISTANCE_H
@@ -20,7 +20,9 @@
 #include "api/storage/IKeyframesManager.h"
 #include "xpcf/component/ComponentBase.h"
 #include "SolARToolsAPI.h"
+#include "SolARSharedStorage.h"
 #include <core/SerializationDefinitions.h>
+#include <functional>
 
 namespace SolAR {
 namespace MODULES {
@@ -32,6 +34,8 @@ namespace TOOLS {
 class SOLAR_TOOLS_EXPORT_API SolARKeyframesManager : public org::bcom::xpcf::ComponentBase,
         public api::storage::IKeyframesManager {
 public:
+	/// @brief the storage of the keyframes, in chunks of 16 consecutive ids
+	using Keyframes = SolARSharedStorage<datastructure::Keyframe, 4>;
 
     /// @brief SolARKeyframesManager default constructor
 	SolARKeyframesManager();
@@ -66,6 +70,13 @@ public:
 	/// @return FrameworkReturnCode::_SUCCESS_ if succeed, else FrameworkReturnCode::_ERROR.
     FrameworkReturnCode getAllKeyframes(std::vector<SRef<datastructure::Keyframe>>& keyframes) const override;
 
+	/// @brief This method allows to get a bounded number of keyframes in the order of their ids
+	/// @param[in] firstId the smallest id of the keyframes to get
+	/// @param[in] maxNbKeyframes the maximum number of keyframes to get
+	/// @param[out] keyframes the keyframes with the smallest ids from firstId
+	/// @return FrameworkReturnCode::_SUCCESS_ if succeed, else FrameworkReturnCode::_ERROR.
+	FrameworkReturnCode getKeyframesFrom(const uint32_t firstId, const uint32_t maxNbKeyframes, std::vector<SRef<datastructure::Keyframe>>& keyframes) const;
+
 	/// @brief This method allow to suppress a keyframe by its id
 	/// @param[in] id of the keyframe to suppress
 	/// @return FrameworkReturnCode::_SUCCESS_ if the suppression succeed, else FrameworkReturnCode::_ERROR.
@@ -99,11 +110,40 @@ public:
 	/// @return FrameworkReturnCode::_SUCCESS_ if the suppression succeed, else FrameworkReturnCode::_ERROR.
 	FrameworkReturnCode loadFromFile(const std::string& file) override;
 
-    void unloadComponent () override final;
+	/// @brief This method takes a snapshot of the keyframes without copying them
+	/// While the snapshot is alive, a chunk of keyframes is copied and its keyframes are cloned by the first access to one of them through the manager,
+	/// so the keyframes of the snapshot are not modified by the components modifying the keyframes they get.
+	/// @return the snapshot, its keyframes must not be modified
+	SRef<const Keyframes> getSnapshot() const;
+
+	/// @brief This method takes a snapshot of the keyframes (see getSnapshot)
+	/// @return a function saving the snapshot to a file, it can be called from another thread
+	std::function<FrameworkReturnCode(const std::string&)> getSnapshotSaver() const;
+
+	/// @brief This method shares the keyframes of another keyframes manager
+	/// A chunk of keyframes is copied and its keyframes are cloned by the first access to one of them through either manager,
+	/// so the keyframes got from a manager are never modified through the other one.
+	/// @param[in] keyframesManager the keyframes manager to share
+	void shareFrom(const SolARKeyframesManager &keyframesManager);
 
+	/// @brief This method allows to get the number of keyframes cloned since the keyframes manager has been created
+	/// @return The number of cloned keyframes
+	size_t getNbClonedKeyframes() const;
+
+	/// @brief This method replaces a stored keyframe by another instance with the same id
+	/// @param[in] keyframe the new instance of the keyframe
+	/// @return FrameworkReturnCode::_SUCCESS_ if the replacement succeed, else FrameworkReturnCode::_ERROR.
+	FrameworkReturnCode replaceKeyframe(const SRef<datastructure::Keyframe> keyframe);
+
+	/// @brief This method renumbers the stored keyframes, the ids of the following keyframes start after the largest new id
+	/// @param[in] idMap the new id of each stored keyframe
+	/// @return FrameworkReturnCode::_SUCCESS_ if the renumbering succeed, else FrameworkReturnCode::_ERROR and nothing is modified.
+	FrameworkReturnCode renumber(const std::map<uint32_t, uint32_t> &idMap);
+
+    void unloadComponent () override final;
 
  private:
-	 std::map<uint32_t, SRef<datastructure::Keyframe>>		m_keyframes;
+	 mutable Keyframes										m_keyframes;
 	 datastructure::DescriptorType							m_descriptorType;
 	 uint32_t								m_id;
      mutable std::mutex						m_mutex;
@@ -0,0 +1,155 @@
+/**
+ * @copyright Copyright (c) 2017 B-com http://www.b-com.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SOLARMAPMAINTENANCESCHEDULER_H
+#define SOLARMAPMAINTENANCESCHEDULER_H
+
+#include "api/solver/map/IMapper.h"
+#include "api/reloc/IKeyframeRetriever.h"
+#include "SolARToolsAPI.h"
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+namespace SolAR {
+namespace MODULES {
+namespace TOOLS {
+
+/**
+ * @class SolARMapMaintenanceScheduler
+ * @brief <B>Runs the maintenance jobs of a map in small time slices.</B>
+ *
+ * The pruning, the culling of the points with too few observations and the sparsification of the covisibility edges
+ * are split into work units. The work units are run by runSlice between frames, or by a background thread, until the
+ * time budget of the slice is spent. The size of a work unit is adapted to the measured cost of its job. The compaction
+ * of the map cannot be split: it is only run by the background thread, and SolARMapper::compact prepares it without
+ * holding the mapper lock. A failed compaction, because the map has been modified meanwhile, is retried later.
+ *
+ * The scheduler is a helper of the application, like SolARStageProfiler, not a component: it is created with the mapper
+ * whose map it maintains and is configured by its setters.
+ */
+class SOLAR_TOOLS_EXPORT_API SolARMapMaintenanceScheduler
+{
+public:
+	/// @brief Work waiting to be run by the scheduler
+	struct PendingWork {
+		size_t	nbPruningPoints = 0;		///< number of points to check by the pruning
+		size_t	nbCullingPoints = 0;		///< number of points to check by the culling
+		size_t	nbSparsificationNodes = 0;	///< number of covisibility graph nodes whose edges must be sparsified
+		bool	isCompactionPending = false;///< true if a compaction of the map is scheduled
+	};
+
+	///@brief SolARMapMaintenanceScheduler constructor;
+	/// @param[in] mapper: the mapper of the map to maintain
+	SolARMapMaintenanceScheduler(const SRef<api::solver::map::IMapper> mapper);
+
+	///@brief SolARMapMaintenanceScheduler destructor, the background thread is stopped;
+	~SolARMapMaintenanceScheduler();
+
+	/// @brief Set the time budget of a slice
+	/// @param[in] sliceBudget: the time budget in milliseconds (2 by default)
+	void setSliceBudget(const float sliceBudget);
+
+	/// @brief Set the time between two slices of the background thread
+	/// @param[in] backgroundPeriod: the period in milliseconds (10 by default)
+	void setBackgroundPeriod(const int backgroundPeriod);
+
+	/// @brief Set the minimum number of observations of the points kept by the culling
+	/// @param[in] minNbObservations: the culling removes the points observed by fewer keyframes (2 by default)
+	void setMinNbObservations(const int minNbObservations);
+
+	/// @brief Schedule the pruning of all the points of the map
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode schedulePruning();
+
+	/// @brief Schedule the culling of all the points of the map
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode scheduleCulling();
+
+	/// @brief Schedule the sparsification of the covisibility edges, the covisibility graph must be a SolARCovisibilityGraph
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode scheduleEdgeSparsification();
+
+	/// @brief Schedule the compaction of the map, the mapper must be a SolARMapper
+	/// @param[in] keyframeRetriever: an empty keyframe retriever used to rebuild the keyframe retriever of the map, or nullptr to only renumber the cloud points
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode scheduleCompaction(const SRef<api::reloc::IKeyframeRetriever> keyframeRetriever);
+
+	/// @brief Run work units until the time budget is spent or no work is pending
+	/// A work unit is never interrupted, the slice can exceed its budget by the cost of the smallest work unit.
+	/// @param[in] budget: the time budget in milliseconds, the slice budget of the scheduler if it is not positive
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode runSlice(const float budget = 0.f);
+
+	/// @brief Start the background thread running a slice every background period
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode start();
+
+	/// @brief Stop the background thread once its current slice is done
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode stop();
+
+	/// @brief Get the work waiting to be run
+	/// @return the pending work
+	PendingWork getPendingWork() const;
+
+private:
+	/// @brief the jobs split into work units
+	enum Job {
+		PRUNING = 0,
+		CULLING,
+		EDGE_SPARSIFICATION,
+		NB_JOBS
+	};
+
+	/// @brief run a slice, the compaction is only allowed from the background thread
+	void runSlice(const float budget, const bool allowCompaction);
+
+	/// @brief run a work unit of a job on at most nbItems items
+	/// @return the number of processed items
+	size_t runWorkUnit(const Job job, const size_t nbItems);
+
+	/// @brief get the number of items of a job waiting to be processed
+	size_t getNbPendingItems(const Job job) const;
+
+private:
+	SRef<api::solver::map::IMapper>				m_mapper;
+	mutable std::mutex							m_mutex;
+	std::mutex									m_runMutex;
+	std::deque<uint32_t>						m_pruningQueue;
+	std::deque<uint32_t>						m_cullingQueue;
+	bool										m_isSparsificationScheduled = false;
+	bool										m_isCompactionScheduled = false;
+	SRef<api::reloc::IKeyframeRetriever>		m_compactionKeyframeRetriever;
+	int											m_nbCompactionAttempts = 0;
+	double										m_costPerItem[NB_JOBS];
+	int											m_nextJob = 0;
+	std::thread									m_thread;
+	std::atomic<bool>							m_isRunning{ false };
+	std::mutex									m_threadMutex;
+	std::condition_variable						m_threadCondition;
+	std::atomic<float>							m_sliceBudget{ 2.f };
+	std::atomic<int>							m_backgroundPeriod{ 10 };
+	std::atomic<int>							m_minNbObservations{ 2 };
+};
+
+}
+}
+}
+
+#endif // SOLARMAPMAINTENANCESCHEDULER_H
@@ -8,6 +8,12 @@
 #include "xpcf/component/ConfigurableBase.h"
 #include <vector>
 #include <set>
+#include <deque>
+#include <tuple>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <functional>
 #include "SolARToolsAPI.h"
 #include <boost/filesystem.hpp>
 #include <string>
@@ -60,6 +66,20 @@ namespace TOOLS {
  * @SolARComponentProperty{ thresConfidence,
  *                          ,
  *                           @SolARComponentPropertyDescNum{ float, [0..MAX FLOAT], 3.f }}
+ * @SolARComponentProperty{ changeFeedSize,
+ *                          maximum number of point and keyframe ids kept by the change feed (0 to disable it),
+ *                           @SolARComponentPropertyDescNum{ int, [0..MAX INT], 0 }}
+ * @SolARComponentProperty{ maxNbPoints,
+ *                          maximum number of cloud points before evicting the least recently observed ones (0 for no limit),
+ *                           @SolARComponentPropertyDescNum{ int, [0..MAX INT], 0 }}
+ * @SolARComponentProperty{ maxNbKeyframes,
+ *                          maximum number of keyframes before evicting the most redundant ones (0 for no limit). The keyframe retriever cannot suppress
+ *                          the evicted keyframes: it is rebuilt once they reach half of the map and holds at most about 1.5 times this number of keyframes,
+ *                          if a keyframe retriever distinct from the one of the map can be resolved to rebuild it, otherwise it keeps all the evicted keyframes,
+ *                           @SolARComponentPropertyDescNum{ int, [0..MAX INT], 0 }}
+ * @SolARComponentProperty{ maxNbEvictionsPerCall,
+ *                          maximum number of cloud points and keyframes evicted by each modification of the map,
+ *                           @SolARComponentPropertyDescNum{ int, [1..MAX INT], 100 }}
  * @SolARComponentPropertiesEnd
  *
  */
@@ -80,10 +100,96 @@ public:
     /// @return FrameworkReturnCode::_SUCCESS_ if all data structures successfully setted, else FrameworkReturnCode::_ERROR.
     FrameworkReturnCode set(const SRef<IMapper> floating_mapper) override;
 
-    /// @brief Get the mapper
+    /// @brief Get a fork of the mapper
+    /// The fork is built by fork with a keyframe retriever resolved by the component manager. It fails if the keyframe
+    /// retriever is bound as a singleton, since both maps would add their keyframes with the same ids to the same retriever.
+    /// @param[out] mapper: the fork of the mapper
     /// @return FrameworkReturnCode::_SUCCESS_ if successfully, else FrameworkReturnCode::_ERROR.
     FrameworkReturnCode get(SRef<IMapper> & mapper) override;
 
+	/// @brief Get a fork of the mapper
+	/// The chunks of points and keyframes are shared with the fork, a chunk is copied and its points or keyframes are cloned by the first access
+	/// to one of them through the managers of either mapper. The points and keyframes got from a manager, including the ones modified directly
+	/// by other components such as the loop corrector or the bundler, are never shared with the other map.
+	/// The points and keyframes got before the fork must be got again before being modified.
+	/// The covisibility graph is copied and the keyframes are added to the keyframe retriever of the fork.
+	/// @param[out] mapper: the fork of the mapper
+	/// @param[in] keyframeRetriever: an empty keyframe retriever for the fork, distinct from the keyframe retriever of the mapper
+	/// @return FrameworkReturnCode::_SUCCESS_ if successfully, else FrameworkReturnCode::_ERROR.
+	FrameworkReturnCode fork(SRef<IMapper> & mapper, const SRef<api::reloc::IKeyframeRetriever> keyframeRetriever);
+
+	/// @brief Statistics of the memory used by a fork of a mapper
+	struct ForkStatistics {
+		int		nbSharedPoints = 0;		///< number of points shared when the fork has been created
+		int		nbSharedKeyframes = 0;	///< number of keyframes shared when the fork has been created
+		size_t	nbCopiedEdges = 0;		///< number of covisibility edges copied when the fork has been created
+		size_t	nbClonedPoints = 0;		///< number of points cloned since the fork
+		size_t	nbClonedKeyframes = 0;	///< number of keyframes cloned since the fork
+		size_t	estimatedMemory = 0;	///< estimation of the memory used by the copied data in bytes
+	};
+
+	/// @brief Get the statistics of the memory used by the fork
+	/// @return the fork statistics
+	ForkStatistics getForkStatistics() const;
+
+	/// @brief Histogram of a map measure, the last bin counts all the values above the previous bins
+	struct Histogram {
+		float					binWidth = 1.f;	///< width of a bin
+		std::vector<uint32_t>	counts;			///< number of values per bin
+	};
+
+	/// @brief Footprint and health statistics of a map
+	struct MapStatistics {
+		uint64_t	mapVersion = 0;				///< version of the map, increased by each modification done through the mapper
+		int			nbPoints = 0;				///< number of cloud points
+		int			nbKeyframes = 0;			///< number of keyframes
+		size_t		nbEdges = 0;				///< number of covisibility edges
+		size_t		coordinatesBytes = 0;		///< estimation of the memory used by the cloud points and the keyframe keypoints
+		size_t		descriptorsBytes = 0;		///< estimation of the memory used by the descriptors of the cloud points and the keyframes
+		size_t		imagesBytes = 0;			///< estimation of the memory used by the keyframe images
+		size_t		visibilitiesBytes = 0;		///< estimation of the memory used by the visibilities of the cloud points and the keyframes
+		Histogram	observationsPerPoint;		///< histogram of the number of keyframes observing a cloud point
+		Histogram	keyframeDegree;				///< histogram of the number of covisibility neighbors of a keyframe
+		Histogram	reprojectionError;			///< histogram of the reprojection error of the cloud points
+		double		lastPruningAge = -1.0;		///< time since the last pruning in seconds, -1 if the map has never been pruned
+		size_t		lastPruningNbPoints = 0;	///< number of cloud points removed by the last pruning
+	};
+
+	/// @brief Get the footprint and health statistics of the map
+	/// The points and keyframes are read from a snapshot taken under the map lock, so the map is not locked while the statistics are computed.
+	/// The map lock is held during the whole computation if the storage components cannot take a snapshot.
+	/// @param[out] statistics: the map statistics
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode getStatistics(MapStatistics &statistics) const;
+
+	/// @brief Get the footprint and health statistics of the map as a JSON string
+	/// @param[out] json: the map statistics in JSON format
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode getStatistics(std::string &json) const;
+
+	/// @brief Get the version of the map
+	/// The version is increased by each modification done through the mapper.
+	/// @return the map version
+	uint64_t getMapVersion() const;
+
+	/// @brief Get the version of the last reset of the map
+	/// The map is reset when it is loaded, set or compacted. The ids of the cloud points and the keyframes obtained before the reset
+	/// cannot be compared with the current ones.
+	/// @return the map version of the last reset
+	uint64_t getResetVersion() const;
+
+	/// @brief Get the ids of the cloud points and the keyframes changed since a version of the map
+	/// A changed keyframe is a keyframe whose visibilities have been modified or which has been removed, a changed cloud point
+	/// has been added, removed or has lost visibilities. The changes are only kept when the changeFeedSize property is set,
+	/// and only the most recent ones are kept. Loading or setting the map discards the changes.
+	/// @param[in] version: the version of the map known by the consumer
+	/// @param[out] changedPointIds: the sorted ids of the changed cloud points
+	/// @param[out] changedKeyframeIds: the sorted ids of the changed keyframes
+	/// @param[out] currentVersion: the current version of the map
+	/// @return FrameworkReturnCode::_SUCCESS if the changes are available, else FrameworkReturnCode::_ERROR_ and the consumer must rebuild its data
+	FrameworkReturnCode getChangesSince(const uint64_t version, std::vector<uint32_t> &changedPointIds, std::vector<uint32_t> &changedKeyframeIds,
+										uint64_t &currentVersion) const;
+
 	/// @brief Set identification component.
    /// @param[in] an identification instance
    /// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
@@ -151,11 +257,33 @@ public:
    /// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
     FrameworkReturnCode getLocalPointCloud(const SRef<datastructure::Keyframe> keyframe, const float minWeightNeighbor, std::vector<SRef<datastructure::CloudPoint>> &localPointCloud) const override;
 
+	/// @brief Get the changes between a local point cloud and the local point cloud seen from a keyframe and its neighbors
+	/// Points suppressed from the point cloud manager without updating the keyframe visibilities are only detected by getLocalPointCloud.
+	/// A point of the current local point cloud replaced by another instance with the same id, such as a point cloned before
+	/// being modified while the map is shared with a fork, is both removed and added.
+	/// @param[in] localPointCloud: the points of the current local point cloud
+	/// @param[in] keyframe: the keyframe to get the new local point cloud
+	/// @param[in] minWeightNeighbor: the weight to get keyframe neighbors
+	/// @param[out] addedPoints: the points of the new local point cloud which are not in the current one
+	/// @param[out] removedPointIds: the sorted ids of the points of the current local point cloud which are not in the new one
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode getLocalPointCloudDelta(const std::vector<SRef<datastructure::CloudPoint>> &localPointCloud, const SRef<datastructure::Keyframe> keyframe,
+												const float minWeightNeighbor, std::vector<SRef<datastructure::CloudPoint>> &addedPoints, std::vector<uint32_t> &removedPointIds) const;
+
 	/// @brief Add a point cloud to mapper and update visibility of keyframes and covisibility graph
 	/// @param[in] cloudPoint: the cloud point to add to the mapper
 	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
     FrameworkReturnCode addCloudPoint(const SRef<datastructure::CloudPoint> cloudPoint) override;
 
+	/// @brief Add cloud points to mapper and update visibility of keyframes and covisibility graph
+	/// When the map is bounded by the maxNbPoints or maxNbKeyframes properties, each modification evicts at most maxNbEvictionsPerCall
+	/// cloud points and keyframes over the limits, with the semantics of removeCloudPoint and removeKeyframe. The selection of the cloud points
+	/// and the keyframes to evict is spread over several modifications, and the pinned keyframes are not evicted.
+	/// The ids of the cloud points are set at once, each keyframe is got once and the covisibility graph is updated once per keyframe pair.
+	/// @param[in] cloudPoints: the cloud points to add to the mapper
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode addCloudPoints(const std::vector<SRef<datastructure::CloudPoint>> &cloudPoints);
+
 	/// @brief Remove a point cloud from mapper and update visibility of keyframes and covisibility graph
 	/// @param[in] cloudPoint: the cloud point to remove to the mapper
 	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
@@ -166,6 +294,78 @@ public:
 	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
     FrameworkReturnCode removeKeyframe(const SRef<datastructure::Keyframe> keyframe) override;
 
+	/// @brief Batch of modifications of the map applied at once by commit
+	class Transaction {
+	public:
+		/// @brief Add a cloud point to the map, its id is set by the commit
+		void addCloudPoint(const SRef<datastructure::CloudPoint> cloudPoint);
+
+		/// @brief Remove a cloud point from the map
+		void removeCloudPoint(const SRef<datastructure::CloudPoint> cloudPoint);
+
+		/// @brief Remove a keyframe from the map
+		void removeKeyframe(const SRef<datastructure::Keyframe> keyframe);
+
+		/// @brief Add an observation of a cloud point of the map by a keypoint of a keyframe of the map
+		/// The observation is ignored if the keyframe already observes the cloud point or if the keypoint already observes a cloud point.
+		void addObservation(const SRef<datastructure::CloudPoint> cloudPoint, const uint32_t keyframeId, const uint32_t keypointIndex);
+
+		/// @brief Get the number of modifications of the transaction
+		size_t size() const;
+
+		/// @brief Discard the modifications of the transaction
+		void clear();
+
+	private:
+		friend class SolARMapper;
+		std::vector<SRef<datastructure::CloudPoint>>	m_addedPoints;
+		std::vector<SRef<datastructure::CloudPoint>>	m_removedPoints;
+		std::vector<SRef<datastructure::Keyframe>>		m_removedKeyframes;
+		std::vector<std::tuple<SRef<datastructure::CloudPoint>, uint32_t, uint32_t>>	m_addedObservations;
+	};
+
+	/// @brief Protect a keyframe from the eviction, for instance while it is the reference keyframe of a tracking session
+	/// A keyframe pinned several times is protected until it has been unpinned as many times. The pins follow the compaction of the map.
+	/// @param[in] id: the id of the keyframe
+	void pinKeyframe(const uint32_t id);
+
+	/// @brief Release a protection of a keyframe from the eviction
+	/// @param[in] id: the id of the keyframe
+	void unpinKeyframe(const uint32_t id);
+
+	/// @brief Update the confidence of cloud points of the map matched by a tracked frame
+	/// The confidences are updated under the mapper lock, so the cloud points shared by several tracking sessions are updated one at a time.
+	/// @param[in] cloudPoints: the matched cloud points
+	/// @param[in] isInliers: for each cloud point, true if it is an inlier of the pose estimation
+	void updateConfidences(const std::vector<SRef<datastructure::CloudPoint>> &cloudPoints, const std::vector<bool> &isInliers);
+
+	/// @brief Begin a batch of modifications of the map
+	/// @return an empty transaction
+	Transaction beginTransaction() const;
+
+	/// @brief Apply a batch of modifications to the map
+	/// All the modifications are applied under the mapper lock: the keyframes are removed first, then the cloud points,
+	/// then the new cloud points are added and finally the new observations. Each keyframe is got once, the covisibility graph is updated once
+	/// per keyframe pair and the map version is increased once.
+	/// @param[in,out] transaction: the modifications to apply, the transaction is cleared once committed
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode commit(Transaction &transaction);
+
+	/// @brief Renumber the cloud points and the keyframes of the map densely
+	/// The visibilities, the covisibility graph and the keyframe retriever are updated with the new ids. The keyframe retriever
+	/// cannot be cleared, so the keyframes are added to an empty configured keyframe retriever, which is loaded by the keyframe retriever
+	/// of the map through a temporary file: the components holding the keyframe retriever of the map, such as the tracking, the mapping
+	/// or the loop closure detector, retrieve the new ids. The given keyframe retriever is left empty.
+	/// Without a new keyframe retriever or a SolARCovisibilityGraph, only the cloud points are renumbered. The map cannot be compacted
+	/// while it is shared with a living fork. The new ids and visibilities are prepared without the mapper lock, the compaction fails if the map
+	/// has been modified meanwhile. The compaction waits for the pending background saves and resets the map (see getResetVersion).
+	/// @param[in] keyframeRetriever: an empty keyframe retriever distinct from the keyframe retriever of the map, or nullptr to only renumber the cloud points
+	/// @param[out] pointIdMap: the new id of each cloud point
+	/// @param[out] keyframeIdMap: the new id of each keyframe
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode compact(const SRef<api::reloc::IKeyframeRetriever> keyframeRetriever, std::map<uint32_t, uint32_t> &pointIdMap,
+								std::map<uint32_t, uint32_t> &keyframeIdMap);
+
 	/// @brief Prune cloud points and keyframes of a map
 	/// @param[in] cloudPoints: the cloud points are checked to prune
 	void pruning(const std::vector<SRef<datastructure::CloudPoint>> &cloudPoints = {}) override;
@@ -174,6 +374,15 @@ public:
 	 /// @return FrameworkReturnCode::_SUCCESS_ if the suppression succeed, else FrameworkReturnCode::_ERROR.
     FrameworkReturnCode saveToFile() const override;
 
+	/// @brief Save the map to the external file in background
+	/// A snapshot of the map is taken under a short lock, then it is serialized by a detached thread.
+	/// The chunks of points and keyframes are shared with the snapshot, a chunk is copied and its points or keyframes are cloned
+	/// by the next access to one of them through the managers, so the serialized objects are not modified meanwhile.
+	/// The points and keyframes got before the snapshot must be got again before being modified. The keyframe retriever is saved from the background thread.
+	/// @param[in] callback: an optional function called with the result of the save from the background thread
+	/// @return a future on the result of the save, it can be dropped without waiting for the save
+	std::future<FrameworkReturnCode> saveToFileAsync(const std::function<void(FrameworkReturnCode)> &callback = nullptr) const;
+
 	/// @brief Load the map from the external file
 	/// @return FrameworkReturnCode::_SUCCESS_ if the suppression succeed, else FrameworkReturnCode::_ERROR.
 	FrameworkReturnCode loadFromFile() override;
@@ -181,6 +390,82 @@ public:
     void unloadComponent () override final;	
 
 private:
+	/// @brief apply the modifications of a transaction, the visibilities of each keyframe and the covisibility of each keyframe pair are updated once (the lock must be held)
+	void applyTransaction(const Transaction &transaction);
+
+	/// @brief check if the points and the keyframes are shared with a living fork
+	bool isShared() const;
+
+	/// @brief get again a keyframe which can be modified, the keyframe got before a fork or a snapshot may have been replaced by a clone
+	SRef<datastructure::Keyframe> getWritableKeyframe(const SRef<datastructure::Keyframe> &keyframe) const;
+
+	/// @brief evict a part of the cloud points and keyframes over the limits of the map (the lock must be held)
+	void evict();
+
+	/// @brief rebuild the keyframe retriever of the map without the evicted keyframes, with a keyframe retriever resolved at the first rebuild (the lock must be held)
+	void rebuildEvictedKeyframeRetriever();
+
+	/// @brief score the next cloud points to evict, the least recently observed and then the least confident ones,
+	/// the queue is filled once all the points have been scored by successive calls (the lock must be held)
+	void computePointEvictionQueue(const int nbPoints);
+
+	/// @brief score the next keyframes to evict, the most redundant by covisibility and then the least recent ones,
+	/// the queue is filled once all the keyframes have been scored by successive calls (the lock must be held)
+	void computeKeyframeEvictionQueue(const int nbKeyframes);
+
+	/// @brief discard the selection of the cloud points to evict (the lock must be held)
+	void resetPointEviction();
+
+	/// @brief discard the selection of the keyframes to evict (the lock must be held)
+	void resetKeyframeEviction();
+
+	/// @brief check if a keyframe is protected from the eviction
+	bool isPinnedKeyframe(const uint32_t id) const;
+
+	/// @brief rebuild the keyframe retriever of the map in place with keyframes sorted by id, the keyframes are added to an empty keyframe retriever
+	/// which is loaded by the keyframe retriever of the map through a temporary file, then the given keyframe retriever is emptied (the lock must be held)
+	FrameworkReturnCode rebuildKeyframeRetriever(const SRef<api::reloc::IKeyframeRetriever> &keyframeRetriever, const std::vector<SRef<datastructure::Keyframe>> &keyframes);
+
+	/// @brief increase the map version and record the changed cloud points and keyframes in the change feed
+	void notifyChanges(const std::vector<uint32_t> &pointIds, const std::vector<uint32_t> &keyframeIds);
+
+	/// @brief increase the map version and discard the change feed, when the whole map has been replaced
+	void notifyReset();
+
+	/// @brief get the keyframe and its neighbors (the lock must be held)
+	void getNeighborKeyframes(const SRef<datastructure::Keyframe> &keyframe, const float minWeightNeighbor, std::vector<uint32_t> &neighKeyframesId,
+							  std::vector<SRef<datastructure::Keyframe>> &neighKeyframes) const;
+
+	/// @brief get the sorted ids of the points visible from keyframes (the lock must be held)
+	void getVisiblePointIds(const std::vector<SRef<datastructure::Keyframe>> &keyframes, std::vector<uint32_t> &pointIds) const;
+
+	/// @brief Local point cloud computed by the last call of getLocalPointCloud
+	struct LocalPointCloudCache {
+		bool									isValid = false;
+		uint32_t								keyframeId = 0;
+		float									minWeightNeighbor = 0.f;
+		uint64_t								mapVersion = 0;
+		uint64_t								nbVisibilities = 0;
+		int										nbPoints = 0;
+		std::vector<uint32_t>					neighborIds;
+		std::vector<SRef<datastructure::CloudPoint>>	points;
+	};
+
+	/// @brief Cloud points and keyframes changed by a modification of the map
+	struct ChangeFeedEntry {
+		uint64_t								version;
+		std::vector<uint32_t>					pointIds;
+		std::vector<uint32_t>					keyframeIds;
+	};
+
+private:
+	/// @brief the background saves still writing their snapshot, shared with their tasks
+	struct PendingSaves {
+		std::mutex								mutex;
+		std::condition_variable					done;
+		int										nbSaves = 0;
+	};
+
 	SRef<datastructure::Identification>		m_identification;
 	SRef<datastructure::CoordinateSystem>	m_coordinateSystem;
 	SRef<api::storage::IPointCloudManager>	m_pointCloudManager;
@@ -188,6 +473,36 @@ private:
 	SRef<api::storage::ICovisibilityGraph>	m_covisibilityGraph;
 	SRef<api::reloc::IKeyframeRetriever>	m_keyframeRetriever;
     mutable std::mutex                      m_mutex;
+	SRef<std::mutex>						m_saveMutex;
+	SRef<PendingSaves>						m_pendingSaves;
+	SRef<int>								m_sharingToken;		///< held by all the mappers sharing points and keyframes, the map is shared while another mapper holds it
+	ForkStatistics							m_forkStatistics;
+	size_t									m_nbClonedPointsAtFork = 0;		///< number of points cloned by the point cloud manager when the fork has been created
+	size_t									m_nbClonedKeyframesAtFork = 0;	///< number of keyframes cloned by the keyframes manager when the fork has been created
+	std::atomic<uint64_t>					m_mapVersion{ 0 };
+	std::atomic<uint64_t>					m_resetVersion{ 0 };
+	std::deque<uint32_t>					m_pointEvictionQueue;
+	std::deque<uint32_t>					m_keyframeEvictionQueue;
+	uint32_t								m_pointEvictionCursor = 0;		///< id of the next point to score for the eviction
+	std::vector<std::tuple<int64_t, float, uint32_t>>	m_pointEvictionCandidates;
+	uint32_t								m_keyframeEvictionCursor = 0;	///< id of the next keyframe to score for the eviction
+	std::vector<std::tuple<float, uint32_t>>	m_keyframeEvictionCandidates;
+	std::deque<std::tuple<float, uint32_t>>	m_recentKeyframeScores;			///< the most recent scored keyframes, not yet candidates
+	int										m_nbEvictedRetrieverKeyframes = 0;	///< number of evicted keyframes still held by the keyframe retriever
+	SRef<api::reloc::IKeyframeRetriever>	m_retrieverBuilder;				///< empty keyframe retriever used to rebuild the keyframe retriever of the map
+	bool									m_isRetrieverBuilderUnavailable = false;
+	mutable std::mutex						m_pinnedKeyframesMutex;
+	std::map<uint32_t, int>					m_pinnedKeyframes;				///< number of pins of each pinned keyframe
+	mutable std::mutex						m_changeFeedMutex;
+	std::deque<ChangeFeedEntry>				m_changeFeed;
+	size_t									m_changeFeedNbIds = 0;
+	uint64_t								m_changeFeedStartVersion = 0;
+	std::atomic<int64_t>					m_lastPruningTime{ -1 };
+	std::atomic<size_t>						m_lastPruningNbPoints{ 0 };
+	mutable LocalPointCloudCache			m_localPointCloudCache;
+	mutable std::vector<uint32_t>			m_visitedPoints;
+	mutable uint32_t						m_visitedEpoch = 0;
+	mutable std::vector<uint32_t>			m_localPointIds;
 
 	std::string					m_directory;
 	std::string					m_identificationFileName;
@@ -199,6 +514,10 @@ private:
 
     float						m_reprojErrorThres = 3.0f;
     float						m_thresConfidence = 0.3f;
+	int							m_changeFeedSize = 0;
+	int							m_maxNbPoints = 0;
+	int							m_maxNbKeyframes = 0;
+	int							m_maxNbEvictionsPerCall = 100;
 };
 }
 }
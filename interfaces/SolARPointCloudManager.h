@@ -20,7 +20,9 @@
 #include "api/storage/IPointCloudManager.h"
 #include "xpcf/component/ComponentBase.h"
 #include "SolARToolsAPI.h"
+#include "SolARSharedStorage.h"
 #include <core/SerializationDefinitions.h>
+#include <functional>
 
 namespace SolAR {
 namespace MODULES {
@@ -32,6 +34,8 @@ namespace TOOLS {
 class SOLAR_TOOLS_EXPORT_API SolARPointCloudManager : public org::bcom::xpcf::ComponentBase,
         public api::storage::IPointCloudManager {
 public:
+	/// @brief the storage of the points, in chunks of 1024 consecutive ids
+	using PointCloud = SolARSharedStorage<datastructure::CloudPoint, 10>;
 
 	SolARPointCloudManager();
 	~SolARPointCloudManager() = default;
@@ -73,6 +77,13 @@ public:
 	/// @return FrameworkReturnCode::_SUCCESS_ if succeed, else FrameworkReturnCode::_ERROR.
     FrameworkReturnCode getAllPoints(std::vector<SRef<datastructure::CloudPoint>>& points) const override;
 
+	/// @brief This method allows to get a bounded number of 3D points stored in the point cloud in the order of their ids
+	/// @param[in] firstId the smallest id of the points to get
+	/// @param[in] maxNbPoints the maximum number of points to get
+	/// @param[out] points the points with the smallest ids from firstId
+	/// @return FrameworkReturnCode::_SUCCESS_ if succeed, else FrameworkReturnCode::_ERROR.
+	FrameworkReturnCode getPointsFrom(const uint32_t firstId, const uint32_t maxNbPoints, std::vector<SRef<datastructure::CloudPoint>>& points) const;
+
 	/// @brief This method allow to suppress a point stored in the point cloud by its id
 	/// @param[in] id of the point to suppress
 	/// @return FrameworkReturnCode::_SUCCESS_ if the suppression succeed, else FrameworkReturnCode::_ERROR.
@@ -110,11 +121,40 @@ public:
 	/// @return FrameworkReturnCode::_SUCCESS_ if the suppression succeed, else FrameworkReturnCode::_ERROR.
 	FrameworkReturnCode loadFromFile(const std::string& file) override;
 
-	void unloadComponent () override final;
+	/// @brief This method takes a snapshot of the point cloud without copying the points
+	/// While the snapshot is alive, a chunk of points is copied and its points are cloned by the first access to one of them through the manager,
+	/// so the points of the snapshot are not modified by the components modifying the points they get.
+	/// @return the snapshot, its points must not be modified
+	SRef<const PointCloud> getSnapshot() const;
+
+	/// @brief This method takes a snapshot of the point cloud (see getSnapshot)
+	/// @return a function saving the snapshot to a file, it can be called from another thread
+	std::function<FrameworkReturnCode(const std::string&)> getSnapshotSaver() const;
+
+	/// @brief This method shares the point cloud of another point cloud manager
+	/// A chunk of points is copied and its points are cloned by the first access to one of them through either manager,
+	/// so the points got from a manager are never modified through the other one.
+	/// @param[in] pointCloudManager the point cloud manager to share
+	void shareFrom(const SolARPointCloudManager &pointCloudManager);
 
+	/// @brief This method allows to get the number of points cloned since the point cloud manager has been created
+	/// @return The number of cloned points
+	size_t getNbClonedPoints() const;
+
+	/// @brief This method replaces a stored 3D point by another instance with the same id
+	/// @param[in] point the new instance of the 3D point
+	/// @return FrameworkReturnCode::_SUCCESS_ if the replacement succeed, else FrameworkReturnCode::_ERROR.
+	FrameworkReturnCode replacePoint(const SRef<datastructure::CloudPoint> point);
+
+	/// @brief This method renumbers the stored 3D points, the ids of the following 3D points start after the largest new id
+	/// @param[in] idMap the new id of each stored point
+	/// @return FrameworkReturnCode::_SUCCESS_ if the renumbering succeed, else FrameworkReturnCode::_ERROR and nothing is modified.
+	FrameworkReturnCode renumber(const std::map<uint32_t, uint32_t> &idMap);
+
+	void unloadComponent () override final;
 
  private:
-	std::map<uint32_t, SRef<datastructure::CloudPoint>>	m_pointCloud;
+	mutable PointCloud									m_pointCloud;
 	datastructure::DescriptorType						m_descriptorType;
 	uint32_t											m_id;
     mutable std::mutex									m_mutex;
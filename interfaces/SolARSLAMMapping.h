@@ -31,6 +31,7 @@
 #include "api/features/IDescriptorMatcher.h"
 #include "api/solver/pose/I2D3DCorrespondencesFinder.h"
 #include "SolARToolsAPI.h"
+#include "SolARStageProfiler.h"
 #include "xpcf/component/ConfigurableBase.h"
 
 namespace SolAR {
@@ -68,6 +69,18 @@ namespace TOOLS {
 * @SolARComponentProperty{ minTrackedPoints,
 *                          ,
 *                          @SolARComponentPropertyDescNum{ int, [0..MAX INT], 100 }}
+* @SolARComponentProperty{ minPointDistance,
+*                          a new point closer to an existing point is merged with it (0 to disable the merge),
+*                          @SolARComponentPropertyDescNum{ float, [0..MAX FLOAT], 0.04f }}
+* @SolARComponentProperty{ maxDescriptorDistance,
+*                          maximum normalized distance between the descriptors of merged points,
+*                          @SolARComponentPropertyDescNum{ float, [0..1], 0.2f }}
+* @SolARComponentProperty{ enableProfiling,
+*                          if not 0 the latency of each stage of the mapping is measured,
+*                          @SolARComponentPropertyDescNum{ int, [0..1], 0 }}
+* @SolARComponentProperty{ profilingLogPeriod,
+*                          number of frames between two logs of the stage latencies (0 to disable the log),
+*                          @SolARComponentPropertyDescNum{ int, [0..MAX INT], 0 }}
 * @SolARComponentPropertiesEnd
 *
 *
@@ -93,9 +106,26 @@ public:
     /// @param[out] keyframe: new keyframe or new reference keyframe found.
     FrameworkReturnCode process(const SRef<datastructure::Frame> frame, SRef<datastructure::Keyframe> & keyframe) override;
 
+	/// @brief get the latency statistics of the stages of the mapping, the enableProfiling property must be set
+	/// @param[out] statistics: the statistics of each stage
+	void getStageStatistics(std::vector<SolARStageProfiler::StageStatistics> &statistics) const;
+
 	void unloadComponent() override final;
 
 private:
+	/// @brief the profiled stages of the mapping
+	enum Stage {
+		STAGE_TOTAL = 0,
+		STAGE_KEYFRAME_SELECTION,
+		STAGE_LOCAL_MAP_CHECK,
+		STAGE_VISIBILITY_UPDATE,
+		STAGE_CULLING,
+		STAGE_TRIANGULATION,
+		STAGE_FUSION,
+		STAGE_INSERTION
+	};
+
+	FrameworkReturnCode mapKeyframe(const SRef<datastructure::Frame> frame, SRef<datastructure::Keyframe> & keyframe);
 	SRef<datastructure::Keyframe> processNewKeyframe(const SRef<datastructure::Frame> &frame);
 	bool checkNeedNewKeyframeInLocalMap(const SRef<datastructure::Frame> &frame);
 	void updateAssociateCloudPoint(const SRef<datastructure::Keyframe> &keyframe);
@@ -107,6 +137,12 @@ private:
 	float																		m_minWeightNeighbor = 1.f;
 	int																			m_minTrackedPoints = 100;
 	int																			m_maxNbNeighborKfs = 5;
+	float																		m_minPointDistance = 0.04f;
+	float																		m_maxDescriptorDistance = 0.2f;
+	uint64_t																	m_nbMergedCloudPoints = 0;
+	int																			m_enableProfiling = 0;
+	int																			m_profilingLogPeriod = 0;
+	SolARStageProfiler															m_profiler;
 	SRef<datastructure::Keyframe>												m_updatedReferenceKeyframe;
 	datastructure::CamCalibration												m_camMatrix;
 	datastructure::CamDistortion												m_camDistortion;
@@ -29,7 +29,15 @@
 #include "api/geom/IProject.h"
 #include "api/reloc/IKeyframeRetriever.h"
 #include "SolARToolsAPI.h"
+#include "SolARStageProfiler.h"
 #include "xpcf/component/ConfigurableBase.h"
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <map>
+#include <deque>
+#include <chrono>
 
 namespace SolAR {
 namespace MODULES {
@@ -40,6 +48,11 @@ namespace TOOLS {
 * @brief <B> SLAM tracking task.</B>
 * <TT>UUID: c45da19d-9637-48b6-ab52-33d3f0af6f72</TT>
 *
+* A tracking component can serve several sessions sharing the same map. Each session created by createSession has its own
+* reference keyframe, local map, motion model and scratch buffers, it is relocalized until it gets a reference keyframe.
+* The methods of the ITracking interface use the default session 0.
+* The sessions tracking with the injected components are serialized, a session given its own components runs concurrently.
+*
 * @SolARComponentInjectablesBegin
 * @SolARComponentInjectable{SolAR::api::solver::map::IMapper}
 * @SolARComponentInjectable{SolAR::api::storage::IKeyframesManager}
@@ -63,6 +76,39 @@ namespace TOOLS {
 * @SolARComponentProperty{ displayTrackedPoints,
 *                          ,
 *                          @SolARComponentPropertyDescNum{ int, [0..MAX INT], 1 }}
+* @SolARComponentProperty{ keypointGridCellSize,
+*                          size in pixels of the cells of the grid indexing the keypoints of a frame (0 to match the local map with the matchInRegion method of the matcher),
+*                          @SolARComponentPropertyDescNum{ int, [0..MAX INT], 0 }}
+* @SolARComponentProperty{ searchRadius,
+*                          radius in pixels around a projected point of the local map in which its keypoints are searched with the keypoint grid,
+*                          @SolARComponentPropertyDescNum{ float, [0..MAX FLOAT], 10.f }}
+* @SolARComponentProperty{ useMotionModel,
+*                          if not 0 the local map is projected with the pose predicted by a constant velocity model and the reference keyframe is matched only if this guided matching fails,
+*                          @SolARComponentPropertyDescNum{ int, [0..1], 0 }}
+* @SolARComponentProperty{ motionModelSearchRadius,
+*                          radius in pixels of the guided matching with the motion model,
+*                          @SolARComponentPropertyDescNum{ float, [0..MAX FLOAT], 15.f }}
+* @SolARComponentProperty{ displayMode,
+*                          0 to draw into a new copy of the frame image / 1 to draw into a reused image of a pool / 2 for headless tracking where the display image is the frame image without overlay,
+*                          @SolARComponentPropertyDescNum{ int, [0..2], 0 }}
+* @SolARComponentProperty{ asyncRelocalization,
+*                          if not 0 the relocalization runs in a background thread on the latest lost frame and the stale lost frames are dropped,
+*                          @SolARComponentPropertyDescNum{ int, [0..1], 0 }}
+* @SolARComponentProperty{ enableProfiling,
+*                          if not 0 the latency of each stage of the tracking is measured,
+*                          @SolARComponentPropertyDescNum{ int, [0..1], 0 }}
+* @SolARComponentProperty{ profilingLogPeriod,
+*                          number of frames between two logs of the stage latencies (0 to disable the log),
+*                          @SolARComponentPropertyDescNum{ int, [0..MAX INT], 0 }}
+* @SolARComponentProperty{ latencyBudget,
+*                          time budget of a frame in milliseconds (0 to disable): when it is nearly spent the candidates of the local map are capped then the search radius is shrunk then the pose refinement is skipped,
+*                          @SolARComponentPropertyDescNum{ float, [0..MAX FLOAT], 0.f }}
+* @SolARComponentProperty{ degradedMaxCandidates,
+*                          maximum number of local map candidates kept by confidence when they are capped,
+*                          @SolARComponentPropertyDescNum{ int, [0..MAX INT], 300 }}
+* @SolARComponentProperty{ degradedSearchRadiusRatio,
+*                          ratio applied to the search radius when it is shrunk,
+*                          @SolARComponentPropertyDescNum{ float, [0..1], 0.5f }}
 * @SolARComponentPropertiesEnd
 *
 */
@@ -71,11 +117,30 @@ class SOLAR_TOOLS_EXPORT_API SolARSLAMTracking : public org::bcom::xpcf::Configu
 	public api::slam::ITracking
 {
 public:
+	/// @brief degradations applied to a frame to meet the latency budget, combined as flags
+	enum Degradation {
+		DEGRADATION_NONE = 0,
+		DEGRADATION_CAP_CANDIDATES = 1,		///< the local map candidates are capped by confidence
+		DEGRADATION_SHRINK_RADIUS = 2,		///< the search radius of the local map matching is shrunk
+		DEGRADATION_SKIP_REFINEMENT = 4		///< the pose refinement is skipped
+	};
+
+	/// @brief components used by a tracking session, a null component is replaced by the injected one
+	struct SessionComponents {
+		SRef<api::features::IDescriptorMatcher>					matcher;
+		SRef<api::features::IMatchesFilter>						matchesFilter;
+		SRef<api::solver::pose::I2D3DCorrespondencesFinder>		corr2D3DFinder;
+		SRef<api::solver::pose::I3DTransformSACFinderFrom2D3D>	pnpRansac;
+		SRef<api::solver::pose::I3DTransformFinderFrom2D3D>		pnp;
+		SRef<api::geom::IProject>								projector;
+		SRef<api::display::I2DOverlay>							overlay2D;
+	};
+
 	///@brief SolARSLAMTracking constructor;
 	SolARSLAMTracking();
 
-	///@brief SolARSLAMTracking destructor;
-	~SolARSLAMTracking() = default;
+	///@brief SolARSLAMTracking destructor, the relocalization thread is stopped;
+	~SolARSLAMTracking() override;
 
 	/// @brief this method is used to set intrinsic parameters and distorsion of the camera
 	/// @param[in] Camera calibration matrix parameters.
@@ -92,21 +157,215 @@ public:
 	/// @return FrameworkReturnCode::_SUCCESS if tracking succeed, else FrameworkReturnCode::_ERROR_
     FrameworkReturnCode process(const SRef<datastructure::Frame> frame, SRef<datastructure::Image> &displayImage) override;
 
+	/// @brief create a tracking session on the shared map
+	/// @param[out] sessionId: the id of the new session.
+	/// @param[in] components: the components of the session, the camera parameters are set to them.
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode createSession(uint32_t &sessionId, const SessionComponents &components = SessionComponents());
+
+	/// @brief destroy a tracking session, the default session cannot be destroyed
+	/// @param[in] sessionId: the id of the session.
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode destroySession(const uint32_t sessionId);
+
+	/// @brief update the reference keyframe tracked by a session, it is applied by the next frame tracked by the session
+	/// @param[in] sessionId: the id of the session.
+	/// @param[in] refKeyframe: the new reference keyframe.
+	/// @return FrameworkReturnCode::_SUCCESS if succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode updateReferenceKeyframe(const uint32_t sessionId, const SRef<datastructure::Keyframe> refKeyframe);
+
+	/// @brief track a frame of a session
+	/// @param[in] sessionId: the id of the session.
+	/// @param[in] frame: the input frame.
+	/// @param[out] displayImage: the image to display.
+	/// @return FrameworkReturnCode::_SUCCESS if tracking succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode process(const uint32_t sessionId, const SRef<datastructure::Frame> frame, SRef<datastructure::Image> &displayImage);
+
+	/// @brief get the degradations applied to the last frame of a session to meet the latency budget
+	/// @param[in] sessionId: the id of the session.
+	/// @return the Degradation flags of the last frame
+	uint32_t getFrameDegradations(const uint32_t sessionId = 0);
+
+	/// @brief get the latency statistics of the stages of the tracking, the enableProfiling property must be set
+	/// @param[out] statistics: the statistics of each stage
+	void getStageStatistics(std::vector<SolARStageProfiler::StageStatistics> &statistics) const;
+
 	void unloadComponent() override final;
 
 private:
-	void updateLocalMap();
+	/// @brief the profiled stages of the tracking
+	enum Stage {
+		STAGE_TOTAL = 0,
+		STAGE_RELOCALIZATION,
+		STAGE_LOCAL_MAP_UPDATE,
+		STAGE_MATCH,
+		STAGE_FILTER,
+		STAGE_CORRESPONDENCES,
+		STAGE_PNP_RANSAC,
+		STAGE_LOCAL_MAP_CULLING,
+		STAGE_PROJECTION,
+		STAGE_REGION_MATCHING,
+		STAGE_REFINEMENT
+	};
+
+	/// @brief structure of arrays copy of the local map, rebuilt when the local map is updated
+	struct LocalMapCache {
+		std::vector<SRef<datastructure::CloudPoint>>	points;
+		std::vector<float>								x, y, z;
+		std::vector<float>								viewX, viewY, viewZ;
+		std::vector<uint32_t>							ids;
+		std::unordered_map<uint32_t, uint32_t>			indices;	///< index in the cache of each cloud point id
+	};
+
+	/// @brief the modes of the display image
+	enum DisplayMode {
+		DISPLAY_COPY = 0,
+		DISPLAY_POOLED,
+		DISPLAY_HEADLESS
+	};
+
+	/// @brief state and scratch buffers of a tracking session
+	struct Session {
+		uint32_t										id = 0;
+		SessionComponents								components;
+		std::mutex										processMutex;
+		SRef<datastructure::Keyframe>					referenceKeyframe;
+		datastructure::Transform3Df						lastPose = datastructure::Transform3Df::Identity();
+		std::vector<SRef<datastructure::CloudPoint>>	localMap;
+		LocalMapCache									localMapCache;
+		uint64_t										mapResetVersion = 0;	///< the reset version of the map when the local map has been built
+		std::atomic<bool>								isLostTrack{ false };
+		bool											isUpdateReferenceKeyframe = false;
+		SRef<datastructure::Keyframe>					pendingReferenceKeyframe;	///< reference keyframe set by updateReferenceKeyframe, not yet applied by the tracking
+		std::mutex										refKeyframeMutex;		///< protects the pending reference keyframe and the change of the reference keyframe
+		int												gridNbCols = 0;
+		int												gridNbRows = 0;
+		std::vector<uint32_t>							gridCellStarts;			///< index in gridKeypointIndices of the first keypoint of each cell
+		std::vector<uint32_t>							gridKeypointIndices;	///< keypoint indices sorted by cell
+		SRef<datastructure::Frame>						gridFrame;				///< frame indexed by the keypoint grid
+		datastructure::Transform3Df						lastTrackedPose = datastructure::Transform3Df::Identity();
+		datastructure::Transform3Df						motion = datastructure::Transform3Df::Identity();
+		bool											hasLastTrackedPose = false;
+		bool											isMotionValid = false;
+		float											lastMaxMatchDistance = 0.f;	///< maximum distance of the last matching with the reference keyframe, 0 if unknown
+		std::vector<SRef<datastructure::Image>>			displayImagePool;
+		std::chrono::steady_clock::time_point			frameStart;				///< start of the processing of the current frame
+		uint32_t										degradations = DEGRADATION_NONE;	///< degradations applied to the current frame
+	};
+
+	/// @brief get a session
+	/// @return the session, nullptr if it does not exist
+	SRef<Session> getSession(const uint32_t sessionId);
+
+	/// @brief replace the null components of a session by the injected ones
+	/// @return true if the session uses at least one injected component
+	bool bindSessionComponents(SessionComponents &components);
+
+	/// @brief check if a degradation applies to the current frame of a session according to the time elapsed since its start
+	/// @return true if the degradation applies, it is then recorded for the frame
+	bool applyDegradation(Session &session, const Degradation degradation);
+
+	/// @brief set the camera parameters to the components of a session which are not the injected ones
+	void setSessionCameraParameters(const SessionComponents &components);
+
+	/// @brief track a frame of a session, called by process
+	FrameworkReturnCode track(Session &session, const SRef<datastructure::Frame> frame, SRef<datastructure::Image> &displayImage);
+
+	void updateLocalMap(Session &session);
+
+	/// @brief replace the reference keyframe of a session by its pending reference keyframe, called by the tracking of the session
+	void applyPendingReferenceKeyframe(Session &session);
+
+	/// @brief find a keyframe of the map close to a lost frame and use it as reference keyframe
+	/// @param[in] frame: the lost frame.
+	/// @return FrameworkReturnCode::_SUCCESS if the relocalization succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode relocalize(Session &session, const SRef<datastructure::Frame> frame);
+
+	/// @brief give a lost frame to the relocalization thread, the frame of the session waiting to be processed is dropped
+	/// @param[in] sessionId: the id of the lost session.
+	/// @param[in] frame: the lost frame.
+	void postRelocalization(const uint32_t sessionId, const SRef<datastructure::Frame> frame);
+
+	/// @brief initialize the display image according to the display mode
+	/// @param[in] frame: the input frame.
+	/// @param[out] displayImage: the image to display.
+	void initDisplayImage(Session &session, const SRef<datastructure::Frame> frame, SRef<datastructure::Image> &displayImage);
+
+	/// @brief build the grid indexing the keypoints of a frame
+	/// @param[in] frame: the frame whose keypoints are indexed
+	void buildKeypointGrid(Session &session, const SRef<datastructure::Frame> frame);
+
+	/// @brief track a frame by guided matching of the local map projected with the pose predicted by the motion model
+	/// @param[in] frame: the input frame.
+	/// @param[out] displayImage: the image to display.
+	/// @return FrameworkReturnCode::_SUCCESS if tracking succeed, else FrameworkReturnCode::_ERROR_
+	FrameworkReturnCode trackWithMotionModel(Session &session, const SRef<datastructure::Frame> frame, SRef<datastructure::Image> &displayImage);
+
+	/// @brief update the motion model with the pose of a tracked frame
+	void updateMotionModel(Session &session, const datastructure::Transform3Df &pose);
+
+	/// @brief get the points of the local map not already seen which are visible from the pose of the frame and project them
+	/// @param[in] frame: the frame with its pose
+	/// @param[in] idxCPSeen: the ids of the cloud points already seen
+	/// @param[out] localMapCandidates: the visible cloud points
+	/// @param[out] projected2DPtsCandidates: the projections of the visible cloud points
+	void findLocalMapCandidates(Session &session, const SRef<datastructure::Frame> frame, const std::vector<uint32_t> &idxCPSeen,
+								std::vector<SRef<datastructure::CloudPoint>> &localMapCandidates, std::vector<datastructure::Point2Df> &projected2DPtsCandidates);
+
+	/// @brief match projected points of the local map to the keypoints of a frame with the keypoint grid or with the matcher
+	/// @param[in] localMapCandidates: the cloud points
+	/// @param[in] projected2DPtsCandidates: the projections of the cloud points
+	/// @param[in] frame: the frame
+	/// @param[in] radius: the search radius in pixels, the default radius if 0
+	/// @param[in] matchingDistanceMax: the maximum distance between matched descriptors
+	/// @param[out] matches: the matches, the index in descriptor A is the index of the cloud point, the index in descriptor B is the index of the keypoint
+	void matchLocalMap(Session &session, const std::vector<SRef<datastructure::CloudPoint>> &localMapCandidates, const std::vector<datastructure::Point2Df> &projected2DPtsCandidates,
+					   const SRef<datastructure::Frame> frame, const float radius, const float matchingDistanceMax, std::vector<datastructure::DescriptorMatch> &matches);
+
+	/// @brief match projected points to the keypoints of the frame indexed by the keypoint grid, a keypoint is matched at most once
+	/// @param[in] points2D: the projected points
+	/// @param[in] descriptors: the descriptor of each projected point
+	/// @param[in] frame: the frame whose keypoints are indexed by the keypoint grid
+	/// @param[out] matches: the matches, the index in descriptor A is the index of the projected point, the index in descriptor B is the index of the keypoint
+	/// @param[in] radius: the search radius in pixels
+	/// @param[in] matchingDistanceMax: the maximum distance between matched descriptors
+	void matchInGrid(Session &session, const std::vector<datastructure::Point2Df> &points2D, const std::vector<SRef<datastructure::DescriptorBuffer>> &descriptors,
+					 const SRef<datastructure::Frame> frame, std::vector<datastructure::DescriptorMatch> &matches, const float radius, const float matchingDistanceMax);
+
+	/// @brief update the confidence of the cloud points matched by a frame, the cloud points can be shared by several sessions
+	/// @param[in] cloudPoints: the matched cloud points
+	/// @param[in] isInliers: for each cloud point, true if it is an inlier of the pose estimation
+	void updateConfidences(const std::vector<SRef<datastructure::CloudPoint>> &cloudPoints, const std::vector<bool> &isInliers);
 
 private:
-	SRef<datastructure::Keyframe>						m_referenceKeyframe;
-	datastructure::Transform3Df							m_lastPose = datastructure::Transform3Df::Identity();
-	std::vector<SRef<datastructure::CloudPoint>>		m_localMap;
-	bool												m_isLostTrack = false;
 	float												m_minWeightNeighbor = 10.f;
 	float												m_thresAngleViewDirection = 0.7f;
 	int													m_displayTrackedPoints = 1;
-	bool												m_isUpdateReferenceKeyframe = false;
-	std::mutex											m_refKeyframeMutex;
+	int													m_keypointGridCellSize = 0;
+	float												m_searchRadius = 10.f;
+	int													m_useMotionModel = 0;
+	float												m_motionModelSearchRadius = 15.f;
+	int													m_displayMode = DISPLAY_COPY;
+	int													m_asyncRelocalization = 0;
+	std::thread											m_relocThread;
+	bool												m_isRelocRunning = false;
+	std::mutex											m_relocMutex;
+	std::condition_variable								m_relocCondition;
+	std::map<uint32_t, SRef<datastructure::Frame>>		m_relocFrames;			///< latest lost frame of each session waiting to be relocalized
+	std::deque<uint32_t>								m_relocOrder;			///< sessions waiting to be relocalized, in the order they got lost
+	int													m_enableProfiling = 0;
+	int													m_profilingLogPeriod = 0;
+	SolARStageProfiler									m_profiler;
+	std::map<uint32_t, SRef<Session>>					m_sessions;
+	std::mutex											m_sessionsMutex;
+	uint32_t											m_nextSessionId = 1;
+	std::mutex											m_sharedComponentsMutex;	///< serializes the sessions using the injected components
+	std::mutex											m_retrieverMutex;
+	std::mutex											m_confidenceMutex;		///< serializes the updates of the confidences without a SolARMapper
+	bool												m_isCameraParametersSet = false;
+	float												m_latencyBudget = 0.f;
+	int													m_degradedMaxCandidates = 300;
+	float												m_degradedSearchRadiusRatio = 0.5f;
 	datastructure::CamCalibration						m_camMatrix;
 	datastructure::CamDistortion						m_camDistortion;
 	SRef<api::solver::map::IMapper>						m_mapper;
@@ -0,0 +1,175 @@
+/**
+ * @copyright Copyright (c) 2017 B-com http://www.b-com.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SOLARSHAREDSTORAGE_H
+#define SOLARSHAREDSTORAGE_H
+
+#include "xpcf/core/refs.h"
+#include "xpcf/core/helpers.h"
+#include <map>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+namespace SolAR {
+namespace MODULES {
+namespace TOOLS {
+
+/**
+ * @class SolARSharedStorage
+ * @brief <B>Stores objects by id, a copy of the storage shares its objects until they are accessed.</B>
+ *
+ * The objects are stored in chunks of 2^ChunkBits consecutive ids. Copying the storage, to take a snapshot or to share it with another storage,
+ * only copies the table of the chunks. A chunk shared by several storages is copied by the first access to any of its objects through one of them,
+ * and its objects are cloned: the objects got from a storage are never shared with another storage, so they can be modified without modifying
+ * a snapshot or another map. The objects got before the storage has been copied must be got again before being modified.
+ * The storage is not thread safe, its owner locks it.
+ */
+template <class T, uint32_t ChunkBits>
+class SolARSharedStorage
+{
+public:
+	using Objects = std::map<uint32_t, SRef<T>>;
+
+	/// @brief get an object, its chunk is cloned if it is shared
+	/// @param[in] id the id of the object
+	/// @return the object, nullptr if there is no object with this id
+	SRef<T> get(const uint32_t id)
+	{
+		auto chunkIt = m_chunks.find(id >> ChunkBits);
+		if (chunkIt == m_chunks.end())
+			return nullptr;
+		const Objects &chunk = getOwnedChunk(chunkIt->second);
+		auto it = chunk.find(id);
+		return it == chunk.end() ? nullptr : it->second;
+	}
+
+	/// @brief get the objects in the order of their ids, their chunks are cloned if they are shared
+	/// @param[in] firstId the smallest id of the objects to get
+	/// @param[in] maxNbObjects the maximum number of objects to get
+	/// @param[out] objects the objects with the smallest ids from firstId are added
+	void getFrom(const uint32_t firstId, const size_t maxNbObjects, std::vector<SRef<T>> &objects)
+	{
+		size_t nbObjects(0);
+		for (auto chunkIt = m_chunks.lower_bound(firstId >> ChunkBits); (chunkIt != m_chunks.end()) && (nbObjects < maxNbObjects); ++chunkIt) {
+			const Objects &chunk = getOwnedChunk(chunkIt->second);
+			for (auto it = chunk.lower_bound(firstId); (it != chunk.end()) && (nbObjects < maxNbObjects); ++it, ++nbObjects)
+				objects.push_back(it->second);
+		}
+	}
+
+	/// @brief get all the objects in the order of their ids, their chunks are cloned if they are shared
+	/// @param[out] objects the objects are added
+	void getAll(std::vector<SRef<T>> &objects)
+	{
+		objects.reserve(objects.size() + m_size);
+		getFrom(0, m_size, objects);
+	}
+
+	/// @brief visit the objects in the order of their ids without cloning them, the objects must not be modified
+	/// A storage copied as a snapshot is visited to read its objects while the copied storage is modified.
+	/// @param[in] visitor the function called with each object
+	void forEach(const std::function<void(const SRef<T> &)> &visitor) const
+	{
+		for (const auto &chunk : m_chunks)
+			for (const auto &it : *chunk.second)
+				visitor(it.second);
+	}
+
+	/// @brief check if an object is stored
+	bool contains(const uint32_t id) const
+	{
+		auto chunkIt = m_chunks.find(id >> ChunkBits);
+		return (chunkIt != m_chunks.end()) && (chunkIt->second->count(id) > 0);
+	}
+
+	/// @brief add an object, or replace the object with the same id
+	/// @param[in] id the id of the object
+	/// @param[in] object the object
+	void set(const uint32_t id, const SRef<T> &object)
+	{
+		SRef<Objects> &chunk = m_chunks[id >> ChunkBits];
+		if (!chunk)
+			chunk = org::bcom::xpcf::utils::make_shared<Objects>();
+		Objects &objects = getOwnedChunk(chunk);
+		if (objects.count(id) == 0)
+			m_size++;
+		objects[id] = object;
+	}
+
+	/// @brief remove an object
+	/// @param[in] id the id of the object
+	/// @return true if the object has been removed, false if there is no object with this id
+	bool erase(const uint32_t id)
+	{
+		auto chunkIt = m_chunks.find(id >> ChunkBits);
+		if ((chunkIt == m_chunks.end()) || (chunkIt->second->count(id) == 0))
+			return false;
+		// the other objects of a shared chunk are cloned, the chunk would not be known as shared anymore
+		getOwnedChunk(chunkIt->second).erase(id);
+		if (chunkIt->second->empty())
+			m_chunks.erase(chunkIt);
+		m_size--;
+		return true;
+	}
+
+	/// @brief replace all the objects
+	/// @param[in] objects the objects by id
+	void assign(const Objects &objects)
+	{
+		m_chunks.clear();
+		m_size = 0;
+		for (const auto &it : objects)
+			set(it.first, it.second);
+	}
+
+	/// @brief get the number of objects
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	/// @brief get the number of objects cloned since the storage has been created
+	size_t getNbClones() const
+	{
+		return m_nbClones;
+	}
+
+private:
+	/// @brief get a chunk which is not shared, a shared chunk is copied and its objects are cloned
+	Objects &getOwnedChunk(SRef<Objects> &chunk)
+	{
+		if (chunk.use_count() > 1) {
+			SRef<Objects> clone = org::bcom::xpcf::utils::make_shared<Objects>();
+			for (const auto &it : *chunk)
+				clone->emplace_hint(clone->end(), it.first, org::bcom::xpcf::utils::make_shared<T>(*it.second));
+			m_nbClones += clone->size();
+			chunk = clone;
+		}
+		return *chunk;
+	}
+
+private:
+	std::map<uint32_t, SRef<Objects>>	m_chunks;
+	size_t								m_size = 0;
+	size_t								m_nbClones = 0;
+};
+
+}
+}
+}
+
+#endif // SOLARSHAREDSTORAGE_H
@@ -0,0 +1,143 @@
+/**
+ * @copyright Copyright (c) 2017 B-com http://www.b-com.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SOLARSTAGEPROFILER_H
+#define SOLARSTAGEPROFILER_H
+
+#include "SolARToolsAPI.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+
+namespace SolAR {
+namespace MODULES {
+namespace TOOLS {
+
+/**
+ * @class SolARStageProfiler
+ * @brief <B>Measures the latency of the stages of a processing.</B>
+ *
+ * The durations of the last samples of each stage are kept in a rolling window from which the percentiles are computed.
+ * The durations are measured by ScopedTimer objects, which do nothing when the profiler is disabled. Defining
+ * SOLAR_TOOLS_DISABLE_PROFILING removes the measures at compile time.
+ */
+class SOLAR_TOOLS_EXPORT_API SolARStageProfiler
+{
+public:
+	/// @brief Statistics of the durations of a stage in milliseconds
+	struct StageStatistics {
+		std::string	name;			///< name of the stage
+		uint64_t	count = 0;		///< number of samples since the last reset
+		float		mean = 0.f;		///< mean duration since the last reset
+		float		p50 = 0.f;		///< median duration of the rolling window
+		float		p90 = 0.f;		///< 90th percentile of the rolling window
+		float		p99 = 0.f;		///< 99th percentile of the rolling window
+		float		max = 0.f;		///< maximum duration of the rolling window
+	};
+
+	/// @brief Measures the duration of a stage until it is destroyed, stopped or switched to the next stage
+	class ScopedTimer
+	{
+	public:
+#ifndef SOLAR_TOOLS_DISABLE_PROFILING
+		ScopedTimer(SolARStageProfiler &profiler, const int stage) : m_profiler(profiler), m_stage(profiler.isEnabled() ? stage : -1) {
+			if (m_stage >= 0)
+				m_start = std::chrono::steady_clock::now();
+		}
+		~ScopedTimer() { stop(); }
+		/// @brief end the current stage and start the measure of the next one
+		void next(const int stage) {
+			if (m_stage < 0)
+				return;
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			m_profiler.addSample(m_stage, std::chrono::duration<float, std::milli>(now - m_start).count());
+			m_stage = stage;
+			m_start = now;
+		}
+		/// @brief end the current stage
+		void stop() {
+			if (m_stage < 0)
+				return;
+			m_profiler.addSample(m_stage, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - m_start).count());
+			m_stage = -1;
+		}
+	private:
+		SolARStageProfiler &					m_profiler;
+		int										m_stage;
+		std::chrono::steady_clock::time_point	m_start;
+#else
+		ScopedTimer(SolARStageProfiler &, const int) {}
+		void next(const int) {}
+		void stop() {}
+#endif
+	};
+
+	/// @brief SolARStageProfiler constructor
+	/// @param[in] name: the name of the profiled processing, used by the log
+	/// @param[in] stageNames: the names of the stages, a stage is identified by its index
+	/// @param[in] windowSize: the number of the last samples of a stage used to compute its percentiles
+	SolARStageProfiler(const std::string &name, const std::vector<std::string> &stageNames, const uint32_t windowSize = 500);
+
+	/// @brief Enable or disable the measures
+	void setEnabled(const bool enabled) { m_isEnabled = enabled; }
+
+	/// @brief Check if the measures are enabled
+	bool isEnabled() const { return m_isEnabled; }
+
+	/// @brief Set the number of frames between two logs of the statistics
+	/// @param[in] nbFrames: the number of frames, 0 to disable the log
+	void setLogPeriod(const uint32_t nbFrames) { m_logPeriod = nbFrames; }
+
+	/// @brief Add a duration to a stage
+	/// @param[in] stage: the index of the stage
+	/// @param[in] duration: the duration in milliseconds
+	void addSample(const int stage, const float duration);
+
+	/// @brief Count a processed frame and log the statistics every log period
+	void endFrame();
+
+	/// @brief Get the statistics of all the stages
+	/// @param[out] statistics: the statistics of each stage, in the order of the stage names
+	void getStatistics(std::vector<StageStatistics> &statistics) const;
+
+	/// @brief Clear all the samples
+	void reset();
+
+private:
+	struct Stage {
+		std::vector<float>	window;
+		uint32_t			next = 0;
+		uint64_t			count = 0;
+		double				total = 0.0;
+	};
+
+	std::string					m_name;
+	std::vector<std::string>	m_stageNames;
+	std::vector<Stage>			m_stages;
+	uint32_t					m_windowSize;
+	std::atomic<bool>			m_isEnabled{ false };
+	std::atomic<uint32_t>		m_logPeriod{ 0 };
+	std::atomic<uint64_t>		m_nbFrames{ 0 };
+	mutable std::mutex			m_mutex;
+};
+
+}
+}
+}
+
+#endif // SOLARSTAGEPROFILER_H
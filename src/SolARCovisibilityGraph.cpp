@@ -16,15 +16,12 @@
 
 #include "SolARCovisibilityGraph.h"
 #include "xpcf/component/ComponentFactory.h"
-#include <mutex>
 #include "core/Log.h"
 
 namespace xpcf  = org::bcom::xpcf;
 
 XPCF_DEFINE_FACTORY_CREATE_INSTANCE(SolAR::MODULES::TOOLS::SolARCovisibilityGraph);
 
-std::mutex m_mutex;
-
 namespace SolAR {
 using namespace datastructure;
 namespace MODULES {
@@ -46,44 +43,86 @@ inline static std::pair<uint32_t, uint32_t> separe(uint64_t a_b) {
 	return std::make_pair(_a_b_16[1], _a_b_16[0]); 
 }
 
-SolARCovisibilityGraph::SolARCovisibilityGraph():ComponentBase(xpcf::toUUID<SolARCovisibilityGraph>())
+// add a value to an atomic weight
+inline static void atomicAdd(std::atomic<float> &weight, float value) {
+	float current = weight.load(std::memory_order_relaxed);
+	while (!weight.compare_exchange_weak(current, current + value, std::memory_order_relaxed));
+}
+
+SolARCovisibilityGraph::SolARCovisibilityGraph():ConfigurableBase(xpcf::toUUID<SolARCovisibilityGraph>())
 {
-   addInterface<api::storage::ICovisibilityGraph>(this);
+	declareInterface<api::storage::ICovisibilityGraph>(this);
+	declareProperty("maxNbNeighbors", m_maxNbNeighbors);
+	declareProperty("strongEdgeWeight", m_strongEdgeWeight);
+	declareProperty("compactionPendingNodes", m_compactionPendingNodes);
+	declareProperty("atomicWeightUpdates", m_atomicWeightUpdates);
 }
 
 FrameworkReturnCode SolARCovisibilityGraph::increaseEdge(const uint32_t node1_id, const uint32_t node2_id, const float weight)
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
 	if (node1_id == node2_id)
-		return FrameworkReturnCode::_ERROR_;	
+		return FrameworkReturnCode::_ERROR_;
+	auto edge = join(node1_id, node2_id);
+	// an existing edge is only bumped, this does not need the exclusive lock
+	if (m_atomicWeightUpdates) {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_weights.find(edge);
+		if (it != m_weights.end()) {
+			atomicAdd(it->second, weight);
+			return FrameworkReturnCode::_SUCCESS;
+		}
+	}
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
 
 	// add nodes
 	m_nodes.insert(node1_id);
 	m_nodes.insert(node2_id);
 	// add edge
-	m_edges[node1_id].insert(node2_id);
-	m_edges[node2_id].insert(node1_id);
+	std::set<uint32_t> &edges1 = m_edges[node1_id];
+	std::set<uint32_t> &edges2 = m_edges[node2_id];
+	bool isNewEdge = edges1.insert(node2_id).second;
+	edges2.insert(node1_id);
 	// add weight
-	auto edge = join(node1_id, node2_id);
-	m_weights[edge] += weight;
+	atomicAdd(m_weights.try_emplace(edge, 0.f).first->second, weight);
+	// mark nodes exceeding the maximum number of neighbors, their weak edges are dropped later
+	if (isNewEdge && (m_maxNbNeighbors > 0)) {
+		if (edges1.size() > static_cast<size_t>(m_maxNbNeighbors))
+			m_pendingNodes.insert(node1_id);
+		if (edges2.size() > static_cast<size_t>(m_maxNbNeighbors))
+			m_pendingNodes.insert(node2_id);
+		if ((m_compactionPendingNodes > 0) && (m_pendingNodes.size() >= static_cast<size_t>(m_compactionPendingNodes)))
+			compactPendingNodes();
+	}
 	return FrameworkReturnCode::_SUCCESS;
 }
 
 FrameworkReturnCode SolARCovisibilityGraph::decreaseEdge(const uint32_t node1_id, const uint32_t node2_id, const float weight)
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
 	if (node1_id == node2_id)
 		return FrameworkReturnCode::_ERROR_;
 	auto edge = join(node1_id, node2_id);
-	if (m_weights.count(edge) == 0)
+	// an edge which remains after the decrease does not need the exclusive lock
+	if (m_atomicWeightUpdates) {
+		std::shared_lock<std::shared_mutex> lock(m_mutex);
+		auto it = m_weights.find(edge);
+		if (it == m_weights.end())
+			return FrameworkReturnCode::_ERROR_;
+		float current = it->second.load(std::memory_order_relaxed);
+		while (current > weight) {
+			if (it->second.compare_exchange_weak(current, current - weight, std::memory_order_relaxed))
+				return FrameworkReturnCode::_SUCCESS;
+		}
+	}
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	auto it = m_weights.find(edge);
+	if (it == m_weights.end())
 		return FrameworkReturnCode::_ERROR_;
 	// if m_weight > weight: decrease, else remove edge
-	float &_weight = m_weights.at(edge);
-	if (_weight > weight){
-		_weight -= weight;
+	if (it->second > weight){
+		atomicAdd(it->second, -weight);
 	}
 	else {
-		m_weights.erase(edge);
+		m_weights.erase(it);
 		m_edges.at(node1_id).erase(node2_id);
 		m_edges.at(node2_id).erase(node1_id);
 	}
@@ -92,7 +131,7 @@ FrameworkReturnCode SolARCovisibilityGraph::decreaseEdge(const uint32_t node1_id
 
 FrameworkReturnCode SolARCovisibilityGraph::removeEdge(const uint32_t node1_id, const uint32_t node2_id)
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
 	auto edge = join(node1_id, node2_id);
 	if (m_weights.count(edge) == 0)
 		return FrameworkReturnCode::_ERROR_;
@@ -106,34 +145,35 @@ FrameworkReturnCode SolARCovisibilityGraph::removeEdge(const uint32_t node1_id,
 
 FrameworkReturnCode SolARCovisibilityGraph::getEdge(const uint32_t node1_id, const uint32_t node2_id, float & weight) const
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
-	auto edge = join(node1_id, node2_id);
-	if (m_weights.count(edge) == 0)
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	auto it = m_weights.find(join(node1_id, node2_id));
+	if (it == m_weights.end())
 		return FrameworkReturnCode::_ERROR_;
-	weight = m_weights.at(edge);
+	weight = it->second;
 	return FrameworkReturnCode::_SUCCESS;
 }
 
 bool SolARCovisibilityGraph::isEdge(const uint32_t node1_id, const uint32_t node2_id) const
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
 	return m_weights.count(join(node1_id, node2_id));
 }
 
 FrameworkReturnCode SolARCovisibilityGraph::getAllNodes(std::set<uint32_t>& nodes_id) const
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
 	nodes_id = m_nodes;
 	return FrameworkReturnCode::_SUCCESS;
 }
 
 FrameworkReturnCode SolARCovisibilityGraph::suppressNode(const uint32_t node_id)
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
 	if (m_nodes.find(node_id) == m_nodes.end())
 		return FrameworkReturnCode::_ERROR_;
 	// remove node
 	m_nodes.erase(node_id);
+	m_pendingNodes.erase(node_id);
 	// get all weights to remove
 	std::list<uint64_t> weightsToRemove;
 	const std::set<uint32_t> &edges = m_edges.at(node_id);
@@ -152,16 +192,16 @@ FrameworkReturnCode SolARCovisibilityGraph::suppressNode(const uint32_t node_id)
 
 FrameworkReturnCode SolARCovisibilityGraph::getNeighbors(const uint32_t node_id, const float minWeight, std::vector<uint32_t>& neighbors) const
 {
-	std::unique_lock<std::mutex> lock(m_mutex);
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
 	std::vector < std:: pair<uint32_t, float> > neighbors_weights;
 	auto it = m_edges.find(node_id);
 	if (it == m_edges.end())
 		return FrameworkReturnCode::_ERROR_;
 	// get neighbors
 	for (auto n : it->second) {
-		auto edge = join(node_id, n);
-        if (m_weights.at(edge) > minWeight)
-            neighbors_weights.push_back(std::make_pair(n, m_weights.at(edge)));
+		float weight = m_weights.at(join(node_id, n));
+        if (weight > minWeight)
+            neighbors_weights.push_back(std::make_pair(n, weight));
 	}
 	// sort
 	std::sort(neighbors_weights.begin(), neighbors_weights.end(), [](const std::pair<uint32_t, float> &a, const std::pair<uint32_t, float> &b) {return a.second > b.second; });
@@ -173,13 +213,14 @@ FrameworkReturnCode SolARCovisibilityGraph::getNeighbors(const uint32_t node_id,
 
 FrameworkReturnCode SolARCovisibilityGraph::minimalSpanningTree(std::vector<std::tuple<uint32_t, uint32_t, float>> &edges_weights, float &minTotalWeights)
 {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
 	if (m_nodes.size() == 0)
 		return FrameworkReturnCode::_ERROR_;
 
 	//first, add the elements to the  vector
 	std::vector<std::pair<uint64_t, float>> edges;
 	for (auto const& w : m_weights)
-		edges.push_back(w);
+		edges.push_back(std::make_pair(w.first, w.second.load()));
 	//sort in decreasing order
 	std::sort(edges.begin(), edges.end(), [](const std::pair<uint64_t, float> &a, const std::pair<uint64_t, float>& b) {return a.second < b.second; });
 	std::map<uint32_t, uint32_t> belongs;
@@ -215,7 +256,7 @@ FrameworkReturnCode SolARCovisibilityGraph::minimalSpanningTree(std::vector<std:
 	minTotalWeights = 0;
 	for (auto const &m : mst_edges) {
 		auto i_j = separe(m);
-        edges_weights.push_back(std::make_tuple(i_j.first, i_j.second, m_weights.at(m)));
+        edges_weights.push_back(std::make_tuple(i_j.first, i_j.second, m_weights.at(m).load()));
         minTotalWeights += m_weights.at(m);
 	}
 	return FrameworkReturnCode::_SUCCESS;
@@ -223,13 +264,14 @@ FrameworkReturnCode SolARCovisibilityGraph::minimalSpanningTree(std::vector<std:
 
 FrameworkReturnCode SolARCovisibilityGraph::maximalSpanningTree(std::vector<std::tuple<uint32_t, uint32_t, float>> &edges_weights, float &maxTotalWeights)
 {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
 	if (m_nodes.size() == 0)
 		return FrameworkReturnCode::_ERROR_;
 
 	//first, add the elements to the  vector
 	std::vector<std::pair<uint64_t, float>> edges;
 	for (auto const& w : m_weights) 
-		edges.push_back(w);
+		edges.push_back(std::make_pair(w.first, w.second.load()));
 	//sort in decreasing order
 	std::sort(edges.begin(), edges.end(), [](const std::pair<uint64_t, float> &a, const std::pair<uint64_t, float>& b) {return a.second > b.second; });
 	std::map<uint32_t, uint32_t> belongs;
@@ -265,7 +307,7 @@ FrameworkReturnCode SolARCovisibilityGraph::maximalSpanningTree(std::vector<std:
 	maxTotalWeights = 0;
 	for (auto const &m : mst_edges) {
 		auto i_j = separe(m);
-        edges_weights.push_back(std::make_tuple(i_j.first, i_j.second, m_weights.at(m)));
+        edges_weights.push_back(std::make_tuple(i_j.first, i_j.second, m_weights.at(m).load()));
         maxTotalWeights += m_weights.at(m);
 	}
 	return FrameworkReturnCode::_SUCCESS;
@@ -275,6 +317,7 @@ FrameworkReturnCode SolARCovisibilityGraph::getShortestPath(const uint32_t node1
 {
 	if (node1_id == node2_id)
 		return FrameworkReturnCode::_ERROR_;
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
 	//just need to start
 	struct TreeNode {
 		TreeNode(uint32_t n, uint32_t p) :node(n), parent(p) {}
@@ -321,6 +364,7 @@ FrameworkReturnCode SolARCovisibilityGraph::getShortestPath(const uint32_t node1
 
 FrameworkReturnCode SolARCovisibilityGraph::display() const
 {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
 	// display vertices
 	LOG_INFO("The vertices of the covisibility graph: ");
 	for (auto const &it : m_nodes)
@@ -329,22 +373,36 @@ FrameworkReturnCode SolARCovisibilityGraph::display() const
 	LOG_INFO("The weighted edges of the covisibility graph: ");
 	for (auto const &it : m_weights) {
 		auto edge = it.first;
-		auto weight = it.second;
+		float weight = it.second;
 		auto nodes = separe(edge);
 		std::cout << nodes.first << " - " << nodes.second << " : " << weight << std::endl;
 	}
 	return FrameworkReturnCode::_SUCCESS;
 }
 
+std::function<FrameworkReturnCode(const std::string&)> SolARCovisibilityGraph::getSnapshotSaver() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	// weights are archived as plain values to keep the file format
+	auto weights = xpcf::utils::make_shared<std::map<uint64_t, float>>();
+	for (const auto &it : m_weights)
+		weights->emplace_hint(weights->end(), it.first, it.second.load());
+	auto nodes = xpcf::utils::make_shared<std::set<uint32_t>>(m_nodes);
+	auto edges = xpcf::utils::make_shared<std::map<uint32_t, std::set<uint32_t>>>(m_edges);
+	return [nodes, edges, weights](const std::string& file) {
+		std::ofstream ofs(file, std::ios::binary);
+		OutputArchive oa(ofs);
+		oa << *nodes;
+		oa << *edges;
+		oa << *weights;
+		ofs.close();
+		return FrameworkReturnCode::_SUCCESS;
+	};
+}
+
 FrameworkReturnCode SolARCovisibilityGraph::saveToFile(const std::string& file) const
 {
-	std::ofstream ofs(file, std::ios::binary);
-	OutputArchive oa(ofs);
-	oa << m_nodes;
-	oa << m_edges;
-	oa << m_weights;
-	ofs.close();
-	return FrameworkReturnCode::_SUCCESS;
+	return getSnapshotSaver()(file);
 }
 
 FrameworkReturnCode SolARCovisibilityGraph::loadFromFile(const std::string& file)
@@ -352,14 +410,148 @@ FrameworkReturnCode SolARCovisibilityGraph::loadFromFile(const std::string& file
 	std::ifstream ifs(file, std::ios::binary);
 	if (!ifs.is_open())
 		return FrameworkReturnCode::_ERROR_;
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
     InputArchive ia(ifs);
+	std::map<uint64_t, float> weights;
 	ia >> m_nodes;
 	ia >> m_edges;
-	ia >> m_weights;
+	ia >> weights;
 	ifs.close();
+	m_weights.clear();
+	for (const auto &it : weights)
+		m_weights.emplace_hint(m_weights.end(), std::piecewise_construct, std::forward_as_tuple(it.first), std::forward_as_tuple(it.second));
+	// mark the loaded nodes exceeding the maximum number of neighbors
+	m_pendingNodes.clear();
+	if (m_maxNbNeighbors > 0)
+		for (const auto &it : m_edges)
+			if (it.second.size() > static_cast<size_t>(m_maxNbNeighbors))
+				m_pendingNodes.insert(it.first);
 	return FrameworkReturnCode::_SUCCESS;
 }
 
+FrameworkReturnCode SolARCovisibilityGraph::compact(const uint32_t maxNbNodes)
+{
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	compactPendingNodes(maxNbNodes);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARCovisibilityGraph::renumber(const std::map<uint32_t, uint32_t>& idMap)
+{
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	// the graph is rebuilt at once, the nodes without a new id are dropped with their edges
+	std::set<uint32_t> nodes;
+	std::map<uint32_t, std::set<uint32_t>> edges;
+	std::map<uint64_t, std::atomic<float>> weights;
+	std::set<uint32_t> pendingNodes;
+	for (const auto &node : m_nodes) {
+		auto it = idMap.find(node);
+		if (it == idMap.end())
+			continue;
+		nodes.insert(it->second);
+		edges[it->second];
+	}
+	for (const auto &w : m_weights) {
+		std::pair<uint32_t, uint32_t> nodesId = separe(w.first);
+		auto it1 = idMap.find(nodesId.first);
+		auto it2 = idMap.find(nodesId.second);
+		if ((it1 == idMap.end()) || (it2 == idMap.end()))
+			continue;
+		edges[it1->second].insert(it2->second);
+		edges[it2->second].insert(it1->second);
+		weights.try_emplace(join(it1->second, it2->second), w.second.load(std::memory_order_relaxed));
+	}
+	for (const auto &node : m_pendingNodes) {
+		auto it = idMap.find(node);
+		if (it != idMap.end())
+			pendingNodes.insert(it->second);
+	}
+	m_nodes.swap(nodes);
+	m_edges.swap(edges);
+	m_weights.swap(weights);
+	m_pendingNodes.swap(pendingNodes);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+SolARCovisibilityGraph::CompactionStatistics SolARCovisibilityGraph::getCompactionStatistics() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	CompactionStatistics stats = m_compactionStats;
+	stats.nbPendingNodes = m_pendingNodes.size();
+	return stats;
+}
+
+void SolARCovisibilityGraph::getStrongestNeighbors(const uint32_t node_id, std::set<uint32_t>& strongestNeighbors) const
+{
+	strongestNeighbors.clear();
+	auto it = m_edges.find(node_id);
+	if (it == m_edges.end())
+		return;
+	std::vector<std::pair<uint32_t, float>> neighbors_weights;
+	neighbors_weights.reserve(it->second.size());
+	for (auto n : it->second)
+		neighbors_weights.push_back(std::make_pair(n, m_weights.at(join(node_id, n)).load()));
+	size_t nbStrongest = std::min(neighbors_weights.size(), static_cast<size_t>(m_maxNbNeighbors));
+	// ties are broken by node id so that the selection does not depend on the insertion order
+	std::partial_sort(neighbors_weights.begin(), neighbors_weights.begin() + nbStrongest, neighbors_weights.end(),
+		[](const std::pair<uint32_t, float> &a, const std::pair<uint32_t, float> &b) {
+		return (a.second > b.second) || ((a.second == b.second) && (a.first < b.first)); });
+	for (size_t i = 0; i < nbStrongest; ++i)
+		strongestNeighbors.insert(neighbors_weights[i].first);
+}
+
+uint32_t SolARCovisibilityGraph::compactNode(const uint32_t node_id, std::map<uint32_t, std::set<uint32_t>>& strongestNeighbors)
+{
+	auto it = m_edges.find(node_id);
+	if ((it == m_edges.end()) || (it->second.size() <= static_cast<size_t>(m_maxNbNeighbors)))
+		return 0;
+	auto getStrongest = [&](uint32_t id) -> const std::set<uint32_t>& {
+		auto itStrongest = strongestNeighbors.find(id);
+		if (itStrongest == strongestNeighbors.end()) {
+			itStrongest = strongestNeighbors.insert(std::make_pair(id, std::set<uint32_t>())).first;
+			getStrongestNeighbors(id, itStrongest->second);
+		}
+		return itStrongest->second;
+	};
+	// dropping an edge which is not among the strongest ones of a node does not modify its strongest edges,
+	// so the cached selections remain valid during the whole compaction
+	const std::set<uint32_t> &strongest = getStrongest(node_id);
+	std::vector<uint32_t> edgesToDrop;
+	for (auto n : it->second) {
+		if ((m_weights.at(join(node_id, n)) >= m_strongEdgeWeight) || (strongest.count(n) > 0))
+			continue;
+		if (getStrongest(n).count(node_id) == 0)
+			edgesToDrop.push_back(n);
+	}
+	for (auto n : edgesToDrop) {
+		m_weights.erase(join(node_id, n));
+		it->second.erase(n);
+		m_edges.at(n).erase(node_id);
+	}
+	return static_cast<uint32_t>(edgesToDrop.size());
+}
+
+void SolARCovisibilityGraph::compactPendingNodes(const uint32_t maxNbNodes)
+{
+	if (m_pendingNodes.empty())
+		return;
+	if (m_maxNbNeighbors <= 0) {
+		m_pendingNodes.clear();
+		return;
+	}
+	std::map<uint32_t, std::set<uint32_t>> strongestNeighbors;
+	uint64_t nbRemovedEdges(0);
+	uint32_t nbNodes(0);
+	auto it = m_pendingNodes.begin();
+	for (; (it != m_pendingNodes.end()) && ((maxNbNodes == 0) || (nbNodes < maxNbNodes)); ++it, ++nbNodes)
+		nbRemovedEdges += compactNode(*it, strongestNeighbors);
+	m_pendingNodes.erase(m_pendingNodes.begin(), it);
+	m_compactionStats.nbCompactions++;
+	m_compactionStats.nbCompactedNodes += nbNodes;
+	m_compactionStats.nbRemovedEdges += nbRemovedEdges;
+	LOG_DEBUG("Covisibility graph compaction: {} nodes, {} edges removed", nbNodes, nbRemovedEdges);
+}
+
 
 
 }
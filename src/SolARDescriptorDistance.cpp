@@ -0,0 +1,64 @@
+/**
+ * @copyright Copyright (c) 2017 B-com http://www.b-com.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "SolARDescriptorDistance.h"
+#include <bitset>
+#include <cfloat>
+#include <cmath>
+
+namespace SolAR {
+using namespace datastructure;
+namespace MODULES {
+namespace TOOLS {
+
+float descriptorDistance(const SRef<DescriptorBuffer> &descriptors1, const uint32_t index1, const SRef<DescriptorBuffer> &descriptors2, const uint32_t index2,
+						 const bool normalized)
+{
+	if ((descriptors1->getDescriptorType() != descriptors2->getDescriptorType()) ||
+		(descriptors1->getDescriptorDataType() != descriptors2->getDescriptorDataType()) ||
+		(descriptors1->getDescriptorByteSize() != descriptors2->getDescriptorByteSize()))
+		return normalized ? 1.f : FLT_MAX;
+	const uint32_t byteSize = descriptors1->getDescriptorByteSize();
+	if (descriptors1->getDescriptorDataType() == DescriptorDataType::TYPE_8U) {
+		const uint8_t *d1 = static_cast<const uint8_t*>(descriptors1->data()) + index1 * byteSize;
+		const uint8_t *d2 = static_cast<const uint8_t*>(descriptors2->data()) + index2 * byteSize;
+		uint32_t nbBits(0);
+		for (uint32_t i = 0; i < byteSize; ++i)
+			nbBits += std::bitset<8>(d1[i] ^ d2[i]).count();
+		return normalized ? static_cast<float>(nbBits) / (8 * byteSize) : static_cast<float>(nbBits);
+	}
+	const uint32_t nbElements = byteSize / sizeof(float);
+	const float *d1 = reinterpret_cast<const float*>(static_cast<const uint8_t*>(descriptors1->data()) + index1 * byteSize);
+	const float *d2 = reinterpret_cast<const float*>(static_cast<const uint8_t*>(descriptors2->data()) + index2 * byteSize);
+	float dist(0.f), norm1(0.f), norm2(0.f);
+	for (uint32_t i = 0; i < nbElements; ++i) {
+		dist += (d1[i] - d2[i]) * (d1[i] - d2[i]);
+		if (normalized) {
+			norm1 += d1[i] * d1[i];
+			norm2 += d2[i] * d2[i];
+		}
+	}
+	if (!normalized)
+		return std::sqrt(dist);
+	// the L2 distance is lower than the sum of the norms
+	float sumNorms = std::sqrt(norm1) + std::sqrt(norm2);
+	return sumNorms > 0.f ? std::sqrt(dist) / sumNorms : 0.f;
+}
+
+}
+}
+}
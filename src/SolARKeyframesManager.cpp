@@ -37,7 +37,7 @@ FrameworkReturnCode SolARKeyframesManager::addKeyframe(const SRef<Keyframe> keyf
 {
 	std::unique_lock<std::mutex> lock(m_mutex);
 	keyframe->setId(m_id);
-	m_keyframes[m_id] = keyframe;
+	m_keyframes.set(m_id, keyframe);
 	m_id++;
 	return FrameworkReturnCode::_SUCCESS;
 }
@@ -47,7 +47,7 @@ FrameworkReturnCode SolARKeyframesManager::addKeyframe(const Keyframe & keyframe
     std::unique_lock<std::mutex> lock(m_mutex);
     SRef<Keyframe> keyframe_ptr = xpcf::utils::make_shared<Keyframe>(keyframe);
 	keyframe_ptr->setId(m_id);
-	m_keyframes[m_id] = keyframe_ptr;
+	m_keyframes.set(m_id, keyframe_ptr);
 	m_id++;
 	return FrameworkReturnCode::_SUCCESS;
 }
@@ -55,9 +55,9 @@ FrameworkReturnCode SolARKeyframesManager::addKeyframe(const Keyframe & keyframe
 FrameworkReturnCode SolARKeyframesManager::getKeyframe(const uint32_t id, SRef<Keyframe> & keyframe) const
 {
 	std::unique_lock<std::mutex> lock(m_mutex);
-    std::map< uint32_t, SRef<Keyframe>>::const_iterator keyframeIt = m_keyframes.find(id);
-	if (keyframeIt != m_keyframes.end()) {
-		keyframe = keyframeIt->second;
+	SRef<Keyframe> storedKeyframe = m_keyframes.get(id);
+	if (storedKeyframe) {
+		keyframe = storedKeyframe;
 		return FrameworkReturnCode::_SUCCESS;
 	}
 	else {
@@ -70,12 +70,12 @@ FrameworkReturnCode SolARKeyframesManager::getKeyframes(const std::vector<uint32
 {
 	std::unique_lock<std::mutex> lock(m_mutex);
 	for (auto &it : ids) {
-        std::map< uint32_t, SRef<Keyframe>>::const_iterator keyframeIt = m_keyframes.find(it);
-		if (keyframeIt == m_keyframes.end()) {
+		SRef<Keyframe> keyframe = m_keyframes.get(it);
+		if (!keyframe) {
 			LOG_ERROR("Cannot find keyframe with id {} to get", it);
 			return FrameworkReturnCode::_ERROR_;
 		}
-		keyframes.push_back(keyframeIt->second);
+		keyframes.push_back(keyframe);
 	}
 	return FrameworkReturnCode::_SUCCESS;
 }
@@ -83,19 +83,22 @@ FrameworkReturnCode SolARKeyframesManager::getKeyframes(const std::vector<uint32
 FrameworkReturnCode SolARKeyframesManager::getAllKeyframes(std::vector<SRef<Keyframe>>& keyframes) const
 {
 	std::unique_lock<std::mutex> lock(m_mutex);
-	for (auto keyframeIt = m_keyframes.begin(); keyframeIt != m_keyframes.end(); keyframeIt++)
-		keyframes.push_back(keyframeIt->second);
+	m_keyframes.getAll(keyframes);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARKeyframesManager::getKeyframesFrom(const uint32_t firstId, const uint32_t maxNbKeyframes, std::vector<SRef<Keyframe>>& keyframes) const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_keyframes.getFrom(firstId, maxNbKeyframes, keyframes);
 	return FrameworkReturnCode::_SUCCESS;
 }
 
 FrameworkReturnCode SolARKeyframesManager::suppressKeyframe(const uint32_t id)
 {
 	std::unique_lock<std::mutex> lock(m_mutex);
-	std::map< uint32_t, SRef<Keyframe>>::iterator keyframeIt = m_keyframes.find(id);
-	if (keyframeIt != m_keyframes.end()) {
-		m_keyframes.erase(keyframeIt);
+	if (m_keyframes.erase(id))
 		return FrameworkReturnCode::_SUCCESS;
-	}
 	else {
 		LOG_ERROR("Cannot find keyframe with id {} to suppress", id);
 		return FrameworkReturnCode::_ERROR_;
@@ -118,10 +121,7 @@ FrameworkReturnCode SolARKeyframesManager::setDescriptorType(const DescriptorTyp
 bool SolARKeyframesManager::isExistKeyframe(const uint32_t id) const
 {
 	std::unique_lock<std::mutex> lock(m_mutex);
-	if (m_keyframes.find(id) != m_keyframes.end())
-		return true;
-	else
-		return false;
+	return m_keyframes.contains(id);
 }
 
 int SolARKeyframesManager::getNbKeyframes() const
@@ -130,27 +130,116 @@ int SolARKeyframesManager::getNbKeyframes() const
     return static_cast<int>(m_keyframes.size());
 }
 
-FrameworkReturnCode SolARKeyframesManager::saveToFile(const std::string& file) const
+SRef<const SolARKeyframesManager::Keyframes> SolARKeyframesManager::getSnapshot() const
+{
+	// only the table of the chunks is copied
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return xpcf::utils::make_shared<Keyframes>(m_keyframes);
+}
+
+std::function<FrameworkReturnCode(const std::string&)> SolARKeyframesManager::getSnapshotSaver() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	uint32_t id = m_id;
+	DescriptorType descriptorType = m_descriptorType;
+	SRef<const Keyframes> keyframes = xpcf::utils::make_shared<Keyframes>(m_keyframes);
+	lock.unlock();
+	return [id, descriptorType, keyframes](const std::string& file) {
+		// the keyframes are serialized in the format of a map of the keyframes by id
+		std::map<uint32_t, SRef<Keyframe>> keyframesById;
+		keyframes->forEach([&keyframesById](const SRef<Keyframe> &keyframe) { keyframesById.emplace_hint(keyframesById.end(), keyframe->getId(), keyframe); });
+		std::ofstream ofs(file, std::ios::binary);
+		OutputArchive oa(ofs);
+		oa << id;
+		oa << descriptorType;
+		oa << keyframesById;
+		ofs.close();
+		return FrameworkReturnCode::_SUCCESS;
+	};
+}
+
+void SolARKeyframesManager::shareFrom(const SolARKeyframesManager & keyframesManager)
+{
+	std::unique_lock<std::mutex> lockShared(keyframesManager.m_mutex);
+	uint32_t id = keyframesManager.m_id;
+	DescriptorType descriptorType = keyframesManager.m_descriptorType;
+	Keyframes keyframes = keyframesManager.m_keyframes;
+	lockShared.unlock();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_id = id;
+	m_descriptorType = descriptorType;
+	m_keyframes = keyframes;
+}
+
+size_t SolARKeyframesManager::getNbClonedKeyframes() const
 {
-	std::ofstream ofs(file, std::ios::binary);
-	OutputArchive oa(ofs);
-	oa << m_id;
-	oa << m_descriptorType;
-	oa << m_keyframes;
-	ofs.close();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_keyframes.getNbClones();
+}
+
+FrameworkReturnCode SolARKeyframesManager::replaceKeyframe(const SRef<Keyframe> keyframe)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_keyframes.contains(keyframe->getId())) {
+		LOG_ERROR("Cannot find keyframe with id {} to replace", keyframe->getId());
+		return FrameworkReturnCode::_ERROR_;
+	}
+	m_keyframes.set(keyframe->getId(), keyframe);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARKeyframesManager::renumber(const std::map<uint32_t, uint32_t>& idMap)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	bool isComplete(true);
+	m_keyframes.forEach([&idMap, &isComplete](const SRef<Keyframe> &keyframe) {
+		if (isComplete && (idMap.find(keyframe->getId()) == idMap.end())) {
+			LOG_ERROR("Cannot find the new id of the keyframe with id {}", keyframe->getId());
+			isComplete = false;
+		}
+	});
+	if (!isComplete)
+		return FrameworkReturnCode::_ERROR_;
+	// the keyframes shared with a snapshot or another manager are cloned before their ids are modified
+	std::vector<SRef<Keyframe>> keyframes;
+	m_keyframes.getAll(keyframes);
+	Keyframes renumbered;
+	uint32_t nextId(0);
+	for (const auto &keyframe : keyframes) {
+		uint32_t id = idMap.at(keyframe->getId());
+		keyframe->setId(id);
+		renumbered.set(id, keyframe);
+		nextId = std::max(nextId, id + 1);
+	}
+	m_keyframes = renumbered;
+	m_id = nextId;
 	return FrameworkReturnCode::_SUCCESS;
 }
 
+FrameworkReturnCode SolARKeyframesManager::saveToFile(const std::string& file) const
+{
+	return getSnapshotSaver()(file);
+}
+
 FrameworkReturnCode SolARKeyframesManager::loadFromFile(const std::string& file)
 {
 	std::ifstream ifs(file, std::ios::binary);
 	if (!ifs.is_open())
 		return FrameworkReturnCode::_ERROR_;
     InputArchive ia(ifs);
-	ia >> m_id;
-	ia >> m_descriptorType;
-	ia >> m_keyframes;
+	uint32_t id;
+	DescriptorType descriptorType;
+	std::map<uint32_t, SRef<Keyframe>> keyframesById;
+	ia >> id;
+	ia >> descriptorType;
+	ia >> keyframesById;
 	ifs.close();
+	Keyframes keyframes;
+	keyframes.assign(keyframesById);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_id = id;
+	m_descriptorType = descriptorType;
+	m_keyframes = keyframes;
 	return FrameworkReturnCode::_SUCCESS;
 }
 
@@ -0,0 +1,302 @@
+/**
+ * @copyright Copyright (c) 2017 B-com http://www.b-com.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SolARMapMaintenanceScheduler.h"
+#include "SolARMapper.h"
+#include "SolARCovisibilityGraph.h"
+#include "core/Log.h"
+#include <chrono>
+
+// initial cost of the processing of an item in milliseconds, before it is measured
+#define INITIAL_COST_PER_ITEM 0.01
+// weight of the last measure in the cost of the processing of an item
+#define COST_UPDATE_WEIGHT 0.2
+// maximum number of items of a work unit
+#define MAX_WORK_UNIT_SIZE 10000
+// maximum number of runs of a scheduled compaction which fails
+#define MAX_COMPACTION_ATTEMPTS 3
+
+namespace SolAR {
+using namespace datastructure;
+using namespace api::storage;
+using namespace api::reloc;
+namespace MODULES {
+namespace TOOLS {
+
+SolARMapMaintenanceScheduler::SolARMapMaintenanceScheduler(const SRef<api::solver::map::IMapper> mapper) : m_mapper(mapper)
+{
+	for (int i = 0; i < NB_JOBS; ++i)
+		m_costPerItem[i] = INITIAL_COST_PER_ITEM;
+}
+
+SolARMapMaintenanceScheduler::~SolARMapMaintenanceScheduler()
+{
+	stop();
+}
+
+void SolARMapMaintenanceScheduler::setSliceBudget(const float sliceBudget)
+{
+	m_sliceBudget = sliceBudget;
+}
+
+void SolARMapMaintenanceScheduler::setBackgroundPeriod(const int backgroundPeriod)
+{
+	m_backgroundPeriod = std::max(1, backgroundPeriod);
+}
+
+void SolARMapMaintenanceScheduler::setMinNbObservations(const int minNbObservations)
+{
+	m_minNbObservations = minNbObservations;
+}
+
+FrameworkReturnCode SolARMapMaintenanceScheduler::schedulePruning()
+{
+	SRef<IPointCloudManager> pointCloudManager;
+	if (!m_mapper || (m_mapper->getPointCloudManager(pointCloudManager) != FrameworkReturnCode::_SUCCESS) || !pointCloudManager)
+		return FrameworkReturnCode::_ERROR_;
+	std::vector<SRef<CloudPoint>> points;
+	pointCloudManager->getAllPoints(points);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_pruningQueue.clear();
+	for (const auto &it : points)
+		m_pruningQueue.push_back(it->getId());
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapMaintenanceScheduler::scheduleCulling()
+{
+	SRef<IPointCloudManager> pointCloudManager;
+	if (!m_mapper || (m_mapper->getPointCloudManager(pointCloudManager) != FrameworkReturnCode::_SUCCESS) || !pointCloudManager)
+		return FrameworkReturnCode::_ERROR_;
+	std::vector<SRef<CloudPoint>> points;
+	pointCloudManager->getAllPoints(points);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cullingQueue.clear();
+	for (const auto &it : points)
+		m_cullingQueue.push_back(it->getId());
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapMaintenanceScheduler::scheduleEdgeSparsification()
+{
+	SRef<ICovisibilityGraph> covisibilityGraph;
+	if (!m_mapper || (m_mapper->getCovisibilityGraph(covisibilityGraph) != FrameworkReturnCode::_SUCCESS) ||
+		!std::dynamic_pointer_cast<SolARCovisibilityGraph>(covisibilityGraph)) {
+		LOG_ERROR("The edge sparsification requires a SolARCovisibilityGraph");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_isSparsificationScheduled = true;
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapMaintenanceScheduler::scheduleCompaction(const SRef<IKeyframeRetriever> keyframeRetriever)
+{
+	if (!std::dynamic_pointer_cast<SolARMapper>(m_mapper)) {
+		LOG_ERROR("The compaction requires a SolARMapper");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_isCompactionScheduled = true;
+	m_compactionKeyframeRetriever = keyframeRetriever;
+	m_nbCompactionAttempts = 0;
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapMaintenanceScheduler::runSlice(const float budget)
+{
+	if (!m_mapper)
+		return FrameworkReturnCode::_ERROR_;
+	runSlice(budget > 0.f ? budget : m_sliceBudget.load(), false);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+void SolARMapMaintenanceScheduler::runSlice(const float budget, const bool allowCompaction)
+{
+	// only one slice at a time, from the frame loop or from the background thread
+	std::unique_lock<std::mutex> runLock(m_runMutex);
+	auto start = std::chrono::steady_clock::now();
+	auto elapsed = [&start]() { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+	int nbIdleJobs(0);
+	// the jobs are run in turn, so that a long job does not delay the other ones
+	while ((elapsed() < budget) && (nbIdleJobs < NB_JOBS)) {
+		Job job = static_cast<Job>(m_nextJob);
+		m_nextJob = (m_nextJob + 1) % NB_JOBS;
+		size_t nbPendingItems = getNbPendingItems(job);
+		if (nbPendingItems == 0) {
+			nbIdleJobs++;
+			continue;
+		}
+		nbIdleJobs = 0;
+		// the size of the work unit fits the remaining budget according to the measured cost of the job
+		double remaining = budget - elapsed();
+		size_t nbItems = static_cast<size_t>(std::max(1.0, std::min<double>(MAX_WORK_UNIT_SIZE, remaining / m_costPerItem[job])));
+		auto startUnit = std::chrono::steady_clock::now();
+		size_t nbProcessedItems = runWorkUnit(job, nbItems);
+		double duration = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startUnit).count();
+		if (nbProcessedItems > 0)
+			m_costPerItem[job] = (1.0 - COST_UPDATE_WEIGHT) * m_costPerItem[job] + COST_UPDATE_WEIGHT * std::max(1e-6, duration / nbProcessedItems);
+	}
+	// the compaction cannot be split, it is only run when the other jobs are done
+	if (!allowCompaction || (nbIdleJobs < NB_JOBS))
+		return;
+	SRef<IKeyframeRetriever> keyframeRetriever;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!m_isCompactionScheduled)
+			return;
+		m_isCompactionScheduled = false;
+		keyframeRetriever = m_compactionKeyframeRetriever;
+		m_compactionKeyframeRetriever = nullptr;
+		m_nbCompactionAttempts++;
+	}
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	std::map<uint32_t, uint32_t> pointIdMap, keyframeIdMap;
+	if (!mapper || (mapper->compact(keyframeRetriever, pointIdMap, keyframeIdMap) == FrameworkReturnCode::_SUCCESS))
+		return;
+	// a failed compaction has modified neither the map nor the keyframe retriever, it is retried by a next slice
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_isCompactionScheduled && (m_nbCompactionAttempts < MAX_COMPACTION_ATTEMPTS)) {
+		LOG_DEBUG("The scheduled compaction of the map has failed, it is retried");
+		m_isCompactionScheduled = true;
+		m_compactionKeyframeRetriever = keyframeRetriever;
+	}
+	else
+		LOG_WARNING("The scheduled compaction of the map has failed");
+}
+
+size_t SolARMapMaintenanceScheduler::runWorkUnit(const Job job, const size_t nbItems)
+{
+	if (job == EDGE_SPARSIFICATION) {
+		SRef<ICovisibilityGraph> covisibilityGraph;
+		m_mapper->getCovisibilityGraph(covisibilityGraph);
+		SRef<SolARCovisibilityGraph> graph = std::dynamic_pointer_cast<SolARCovisibilityGraph>(covisibilityGraph);
+		size_t nbNodes(0);
+		if (graph) {
+			nbNodes = std::min(nbItems, graph->getCompactionStatistics().nbPendingNodes);
+			graph->compact(static_cast<uint32_t>(nbNodes));
+		}
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (!graph || (graph->getCompactionStatistics().nbPendingNodes == 0))
+			m_isSparsificationScheduled = false;
+		return nbNodes;
+	}
+	// take the next point ids of the job
+	std::vector<uint32_t> ids;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		std::deque<uint32_t> &queue = (job == PRUNING) ? m_pruningQueue : m_cullingQueue;
+		size_t nbIds = std::min(nbItems, queue.size());
+		ids.assign(queue.begin(), queue.begin() + nbIds);
+		queue.erase(queue.begin(), queue.begin() + nbIds);
+	}
+	SRef<IPointCloudManager> pointCloudManager;
+	m_mapper->getPointCloudManager(pointCloudManager);
+	std::vector<SRef<CloudPoint>> points;
+	points.reserve(ids.size());
+	for (const auto &id : ids) {
+		SRef<CloudPoint> point;
+		if (pointCloudManager->getPoint(id, point) == FrameworkReturnCode::_SUCCESS)
+			points.push_back(point);
+	}
+	if (points.empty())
+		return ids.size();
+	if (job == PRUNING) {
+		m_mapper->pruning(points);
+		return ids.size();
+	}
+	// culling of the points observed by too few keyframes
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	SolARMapper::Transaction transaction;
+	for (const auto &point : points)
+		if (point->getVisibility().size() < static_cast<size_t>(m_minNbObservations.load())) {
+			if (mapper)
+				transaction.removeCloudPoint(point);
+			else
+				m_mapper->removeCloudPoint(point);
+		}
+	if (mapper)
+		mapper->commit(transaction);
+	return ids.size();
+}
+
+size_t SolARMapMaintenanceScheduler::getNbPendingItems(const Job job) const
+{
+	PendingWork pendingWork = getPendingWork();
+	switch (job) {
+	case PRUNING:
+		return pendingWork.nbPruningPoints;
+	case CULLING:
+		return pendingWork.nbCullingPoints;
+	case EDGE_SPARSIFICATION:
+		return pendingWork.nbSparsificationNodes;
+	default:
+		return 0;
+	}
+}
+
+FrameworkReturnCode SolARMapMaintenanceScheduler::start()
+{
+	if (!m_mapper)
+		return FrameworkReturnCode::_ERROR_;
+	if (m_isRunning.exchange(true))
+		return FrameworkReturnCode::_SUCCESS;
+	m_thread = std::thread([this]() {
+		while (m_isRunning) {
+			runSlice(m_sliceBudget, true);
+			std::unique_lock<std::mutex> lock(m_threadMutex);
+			m_threadCondition.wait_for(lock, std::chrono::milliseconds(m_backgroundPeriod.load()), [this]() { return !m_isRunning; });
+		}
+	});
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapMaintenanceScheduler::stop()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_threadMutex);
+		m_isRunning = false;
+	}
+	m_threadCondition.notify_all();
+	if (m_thread.joinable())
+		m_thread.join();
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+SolARMapMaintenanceScheduler::PendingWork SolARMapMaintenanceScheduler::getPendingWork() const
+{
+	PendingWork pendingWork;
+	bool isSparsificationScheduled;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		pendingWork.nbPruningPoints = m_pruningQueue.size();
+		pendingWork.nbCullingPoints = m_cullingQueue.size();
+		pendingWork.isCompactionPending = m_isCompactionScheduled;
+		isSparsificationScheduled = m_isSparsificationScheduled;
+	}
+	if (isSparsificationScheduled && m_mapper) {
+		SRef<ICovisibilityGraph> covisibilityGraph;
+		m_mapper->getCovisibilityGraph(covisibilityGraph);
+		SRef<SolARCovisibilityGraph> graph = std::dynamic_pointer_cast<SolARCovisibilityGraph>(covisibilityGraph);
+		if (graph)
+			pendingWork.nbSparsificationNodes = graph->getCompactionStatistics().nbPendingNodes;
+	}
+	return pendingWork;
+}
+
+}
+}
+}
@@ -15,13 +15,51 @@
  */
 
 #include "SolARMapper.h"
+#include "SolARPointCloudManager.h"
+#include "SolARKeyframesManager.h"
+#include "SolARCovisibilityGraph.h"
+#include "xpcf/component/ComponentFactory.h"
+#include "xpcf/api/IComponentManager.h"
 #include "core/Log.h"
+#include <future>
+#include <sstream>
+#include <tuple>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#if _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace xpcf  = org::bcom::xpcf;
 
 
 XPCF_DEFINE_FACTORY_CREATE_INSTANCE(SolAR::MODULES::TOOLS::SolARMapper)
 
+// approximate size of a covisibility edge
+#define FORK_EDGE_SIZE 128
+// the eviction removes points or keyframes until their number is below this ratio of their limit
+#define EVICTION_TARGET_RATIO 0.9f
+// number of most recent keyframes never evicted
+#define EVICTION_PROTECTED_KEYFRAMES 10
+// maximum number of cloud points scored by each modification of the map while selecting the points to evict
+#define EVICTION_SCAN_NB_POINTS 10000
+// maximum number of keyframes scored by each modification of the map while selecting the keyframes to evict
+#define EVICTION_SCAN_NB_KEYFRAMES 50
+// a point observed by more keyframes than this number is redundant for each of them
+#define EVICTION_REDUNDANT_OBSERVATIONS 3
+// the keyframe retriever is rebuilt once the evicted keyframes it still holds reach this ratio of the keyframes of the map
+#define EVICTION_RETRIEVER_REBUILD_RATIO 0.5f
+// number of bins of the histograms of the map statistics, plus one for the larger values
+#define STATISTICS_NB_BINS 20
+// approximate size of a visibility entry of a cloud point or a keyframe
+#define STATISTICS_VISIBILITY_SIZE 48
+
 namespace SolAR {
 using namespace datastructure;
 using namespace api::storage;
@@ -46,6 +84,13 @@ SolARMapper::SolARMapper():ConfigurableBase(xpcf::toUUID<SolARMapper>())
 	declareProperty("keyframeRetrieverFileName", m_kfRetrieverFileName);
 	declareProperty("reprojErrorThreshold", m_reprojErrorThres);
 	declareProperty("thresConfidence", m_thresConfidence);
+	declareProperty("changeFeedSize", m_changeFeedSize);
+	declareProperty("maxNbPoints", m_maxNbPoints);
+	declareProperty("maxNbKeyframes", m_maxNbKeyframes);
+	declareProperty("maxNbEvictionsPerCall", m_maxNbEvictionsPerCall);
+	m_saveMutex = xpcf::utils::make_shared<std::mutex>();
+	m_pendingSaves = xpcf::utils::make_shared<PendingSaves>();
+	m_sharingToken = xpcf::utils::make_shared<int>(0);
 }
 
 FrameworkReturnCode SolARMapper::setIdentification(SRef<Identification> identification)
@@ -125,89 +170,236 @@ FrameworkReturnCode SolARMapper::getLocalPointCloud(const SRef<Keyframe> keyfram
 	std::unique_lock<std::mutex> lock(m_mutex);
 	// get neighbor keyframes of the keyframe
 	std::vector<uint32_t> neighKeyframesId;
-	m_covisibilityGraph->getNeighbors(keyframe->getId(), minWeightNeighbor, neighKeyframesId);
-	neighKeyframesId.push_back(keyframe->getId());
-	// get all cloud point visibilities from keyframes
-	std::map<uint32_t, std::map<uint32_t, uint32_t>> tmpIdxLocalMap;
-	for (auto const &it : neighKeyframesId) {
-		SRef<Keyframe> keyframe;
-		m_keyframesManager->getKeyframe(it, keyframe);
-		const std::map<uint32_t, uint32_t> &visibility = keyframe->getVisibility();
-		for (auto const &v : visibility)
-			tmpIdxLocalMap[v.second][it] = v.first;
+	std::vector<SRef<Keyframe>> neighKeyframes;
+	getNeighborKeyframes(keyframe, minWeightNeighbor, neighKeyframesId, neighKeyframes);
+	// the cached local point cloud is valid if the map version is unchanged and if the neighbors, their number
+	// of visibilities and the number of points are the same, since the storage components can be modified directly
+	uint64_t mapVersion = m_mapVersion;
+	uint64_t nbVisibilities(0);
+	for (auto const &it : neighKeyframes)
+		nbVisibilities += it->getVisibility().size();
+	int nbPoints = m_pointCloudManager->getNbPoints();
+	if (m_localPointCloudCache.isValid && (m_localPointCloudCache.keyframeId == keyframe->getId()) &&
+		(m_localPointCloudCache.minWeightNeighbor == minWeightNeighbor) && (m_localPointCloudCache.mapVersion == mapVersion) &&
+		(m_localPointCloudCache.nbVisibilities == nbVisibilities) && (m_localPointCloudCache.nbPoints == nbPoints) &&
+		(m_localPointCloudCache.neighborIds == neighKeyframesId)) {
+		localPointCloud.insert(localPointCloud.end(), m_localPointCloudCache.points.begin(), m_localPointCloudCache.points.end());
+		return FrameworkReturnCode::_SUCCESS;
 	}
+	// get the ids of the cloud points visible from the keyframes
+	std::vector<uint32_t> &pointIds = m_localPointIds;
+	getVisiblePointIds(neighKeyframes, pointIds);
 	// get local point cloud
-	for (auto const &it : tmpIdxLocalMap) {
-		SRef<CloudPoint> point;
-		if (m_pointCloudManager->getPoint(it.first, point) == FrameworkReturnCode::_SUCCESS)
-			localPointCloud.push_back(point);
-		else {
-			for (auto const &v : it.second) {
-				SRef<Keyframe> keyframe;
-				m_keyframesManager->getKeyframe(v.first, keyframe);
-				keyframe->removeVisibility(v.second, it.first);
-			}
+	std::vector<SRef<CloudPoint>> &points = m_localPointCloudCache.points;
+	points.clear();
+	points.reserve(pointIds.size());
+	if (m_pointCloudManager->getPoints(pointIds, points) != FrameworkReturnCode::_SUCCESS) {
+		// some points have been suppressed without updating the keyframes, remove their visibilities
+		points.clear();
+		std::vector<uint32_t> removedPointIds;
+		for (auto const &it : pointIds) {
+			SRef<CloudPoint> point;
+			if (m_pointCloudManager->getPoint(it, point) == FrameworkReturnCode::_SUCCESS)
+				points.push_back(point);
+			else
+				removedPointIds.push_back(it);
+		}
+		for (auto &it : neighKeyframes) {
+			std::vector<std::pair<uint32_t, uint32_t>> visibilitiesToRemove;
+			for (auto const &v : it->getVisibility())
+				if (std::binary_search(removedPointIds.begin(), removedPointIds.end(), v.second))
+					visibilitiesToRemove.push_back(v);
+			if (visibilitiesToRemove.empty())
+				continue;
+			it = getWritableKeyframe(it);
+			for (auto const &v : visibilitiesToRemove)
+				it->removeVisibility(v.first, v.second);
+			nbVisibilities -= visibilitiesToRemove.size();
 		}
 	}
+	m_localPointCloudCache.keyframeId = keyframe->getId();
+	m_localPointCloudCache.minWeightNeighbor = minWeightNeighbor;
+	m_localPointCloudCache.mapVersion = mapVersion;
+	m_localPointCloudCache.nbVisibilities = nbVisibilities;
+	m_localPointCloudCache.nbPoints = nbPoints;
+	m_localPointCloudCache.neighborIds.swap(neighKeyframesId);
+	m_localPointCloudCache.isValid = true;
+	localPointCloud.insert(localPointCloud.end(), points.begin(), points.end());
 	return FrameworkReturnCode::_SUCCESS;
 }
 
-FrameworkReturnCode SolARMapper::addCloudPoint(const SRef<CloudPoint> cloudPoint)
+FrameworkReturnCode SolARMapper::getLocalPointCloudDelta(const std::vector<SRef<CloudPoint>>& localPointCloud, const SRef<Keyframe> keyframe, const float minWeightNeighbor, std::vector<SRef<CloudPoint>>& addedPoints, std::vector<uint32_t>& removedPointIds) const
 {
-	// add point to cloud
-	m_pointCloudManager->addPoint(cloudPoint);
-	const std::map<uint32_t, uint32_t>& pointVisibility = cloudPoint->getVisibility();
-	std::vector<uint32_t> keyframeIds;
-	// add visibility to keyframes
-	for (auto const &v : pointVisibility) {		
-		SRef<Keyframe> keyframe;
-		if (m_keyframesManager->getKeyframe(v.first, keyframe) == FrameworkReturnCode::_SUCCESS) {
-			keyframeIds.push_back(v.first);
-			keyframe->addVisibility(v.second, cloudPoint->getId());
+	std::unique_lock<std::mutex> lock(m_mutex);
+	std::vector<uint32_t> neighKeyframesId;
+	std::vector<SRef<Keyframe>> neighKeyframes;
+	getNeighborKeyframes(keyframe, minWeightNeighbor, neighKeyframesId, neighKeyframes);
+	std::vector<uint32_t> &pointIds = m_localPointIds;
+	getVisiblePointIds(neighKeyframes, pointIds);
+	std::vector<std::pair<uint32_t, const CloudPoint*>> localPoints;
+	localPoints.reserve(localPointCloud.size());
+	for (const auto &it : localPointCloud)
+		localPoints.push_back(std::make_pair(it->getId(), it.get()));
+	std::sort(localPoints.begin(), localPoints.end());
+	// compute the differences between both local maps, the points kept are checked to be the same instances
+	std::vector<uint32_t> addedPointIds;
+	std::vector<uint32_t> keptPointIds;
+	std::vector<const CloudPoint*> keptPoints;
+	auto itLocal = localPoints.begin();
+	for (const auto &id : pointIds) {
+		while ((itLocal != localPoints.end()) && (itLocal->first < id))
+			removedPointIds.push_back((itLocal++)->first);
+		if ((itLocal != localPoints.end()) && (itLocal->first == id)) {
+			keptPointIds.push_back(id);
+			keptPoints.push_back((itLocal++)->second);
 		}
+		else
+			addedPointIds.push_back(id);
 	}
-	// update covisibility graph
-	for (int i = 0; i < keyframeIds.size() - 1; i++)
-		for (int j = i + 1; j < keyframeIds.size(); j++)
-			m_covisibilityGraph->increaseEdge(keyframeIds[i], keyframeIds[j], 1);
+	for (; itLocal != localPoints.end(); ++itLocal)
+		removedPointIds.push_back(itLocal->first);
+	// the points suppressed without updating the visibilities are removed by rebuilding the local point cloud
+	std::vector<SRef<CloudPoint>> currentPoints;
+	if (m_pointCloudManager->getPoints(keptPointIds, currentPoints) != FrameworkReturnCode::_SUCCESS)
+		return FrameworkReturnCode::_ERROR_;
+	for (size_t i = 0; i < keptPointIds.size(); ++i)
+		if (currentPoints[i].get() != keptPoints[i]) {
+			removedPointIds.push_back(keptPointIds[i]);
+			addedPointIds.push_back(keptPointIds[i]);
+		}
+	std::sort(removedPointIds.begin(), removedPointIds.end());
+	// get the added points
+	size_t nbAddedPoints = addedPoints.size();
+	if (m_pointCloudManager->getPoints(addedPointIds, addedPoints) != FrameworkReturnCode::_SUCCESS) {
+		addedPoints.resize(nbAddedPoints);
+		for (auto const &it : addedPointIds) {
+			SRef<CloudPoint> point;
+			if (m_pointCloudManager->getPoint(it, point) == FrameworkReturnCode::_SUCCESS)
+				addedPoints.push_back(point);
+		}
+	}
+	LOG_DEBUG("Local point cloud delta: {} added points, {} removed points", addedPoints.size() - nbAddedPoints, removedPointIds.size());
 	return FrameworkReturnCode::_SUCCESS;
 }
 
-FrameworkReturnCode SolARMapper::removeCloudPoint(const SRef<CloudPoint> cloudPoint)
-{	
-	const std::map<uint32_t, uint32_t>& pointVisibility = cloudPoint->getVisibility();
-	std::vector<uint32_t> keyframeIds;
-	// remove visibility from keyframes
-	for (auto const &v : pointVisibility) {
-		SRef<Keyframe> keyframe;
-		if (m_keyframesManager->getKeyframe(v.first, keyframe) == FrameworkReturnCode::_SUCCESS) {
-			keyframeIds.push_back(v.first);
-			keyframe->removeVisibility(v.second, cloudPoint->getId());
+void SolARMapper::getNeighborKeyframes(const SRef<Keyframe>& keyframe, const float minWeightNeighbor, std::vector<uint32_t>& neighKeyframesId, std::vector<SRef<Keyframe>>& neighKeyframes) const
+{
+	m_covisibilityGraph->getNeighbors(keyframe->getId(), minWeightNeighbor, neighKeyframesId);
+	neighKeyframesId.push_back(keyframe->getId());
+	if (m_keyframesManager->getKeyframes(neighKeyframesId, neighKeyframes) != FrameworkReturnCode::_SUCCESS) {
+		neighKeyframes.clear();
+		for (auto const &it : neighKeyframesId) {
+			SRef<Keyframe> neighKeyframe;
+			if (m_keyframesManager->getKeyframe(it, neighKeyframe) == FrameworkReturnCode::_SUCCESS)
+				neighKeyframes.push_back(neighKeyframe);
 		}
 	}
-	// update covisibility graph
-	for (int i = 0; i < keyframeIds.size() - 1; i++)
-		for (int j = i + 1; j < keyframeIds.size(); j++)
-			m_covisibilityGraph->decreaseEdge(keyframeIds[i], keyframeIds[j], 1);
+}
+
+void SolARMapper::getVisiblePointIds(const std::vector<SRef<Keyframe>>& keyframes, std::vector<uint32_t>& pointIds) const
+{
+	// point ids are deduplicated with an epoch array indexed by point id
+	if (++m_visitedEpoch == 0) {
+		std::fill(m_visitedPoints.begin(), m_visitedPoints.end(), 0);
+		m_visitedEpoch = 1;
+	}
+	pointIds.clear();
+	for (auto const &it : keyframes) {
+		const std::map<uint32_t, uint32_t> &visibility = it->getVisibility();
+		for (auto const &v : visibility) {
+			if (v.second >= m_visitedPoints.size())
+				m_visitedPoints.resize(std::max<size_t>(v.second + 1, 2 * m_visitedPoints.size()), 0);
+			if (m_visitedPoints[v.second] != m_visitedEpoch) {
+				m_visitedPoints[v.second] = m_visitedEpoch;
+				pointIds.push_back(v.second);
+			}
+		}
+	}
+	std::sort(pointIds.begin(), pointIds.end());
+}
 
-	// add point to cloud
-	m_pointCloudManager->suppressPoint(cloudPoint->getId());
+void SolARMapper::Transaction::addCloudPoint(const SRef<CloudPoint> cloudPoint)
+{
+	m_addedPoints.push_back(cloudPoint);
+}
+
+void SolARMapper::Transaction::removeCloudPoint(const SRef<CloudPoint> cloudPoint)
+{
+	m_removedPoints.push_back(cloudPoint);
+}
+
+void SolARMapper::Transaction::removeKeyframe(const SRef<Keyframe> keyframe)
+{
+	m_removedKeyframes.push_back(keyframe);
+}
+
+void SolARMapper::Transaction::addObservation(const SRef<CloudPoint> cloudPoint, const uint32_t keyframeId, const uint32_t keypointIndex)
+{
+	m_addedObservations.push_back(std::make_tuple(cloudPoint, keyframeId, keypointIndex));
+}
+
+size_t SolARMapper::Transaction::size() const
+{
+	return m_addedPoints.size() + m_removedPoints.size() + m_removedKeyframes.size() + m_addedObservations.size();
+}
+
+void SolARMapper::Transaction::clear()
+{
+	m_addedPoints.clear();
+	m_removedPoints.clear();
+	m_removedKeyframes.clear();
+	m_addedObservations.clear();
+}
+
+SolARMapper::Transaction SolARMapper::beginTransaction() const
+{
+	return Transaction();
+}
+
+FrameworkReturnCode SolARMapper::commit(Transaction & transaction)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	applyTransaction(transaction);
+	evict();
+	transaction.clear();
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapper::addCloudPoint(const SRef<CloudPoint> cloudPoint)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Transaction transaction;
+	transaction.addCloudPoint(cloudPoint);
+	applyTransaction(transaction);
+	evict();
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapper::addCloudPoints(const std::vector<SRef<CloudPoint>>& cloudPoints)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Transaction transaction;
+	transaction.m_addedPoints = cloudPoints;
+	applyTransaction(transaction);
+	evict();
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapper::removeCloudPoint(const SRef<CloudPoint> cloudPoint)
+{	
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Transaction transaction;
+	transaction.removeCloudPoint(cloudPoint);
+	applyTransaction(transaction);
 	return FrameworkReturnCode::_SUCCESS;
 }
 
 FrameworkReturnCode SolARMapper::removeKeyframe(const SRef<Keyframe> keyframe)
 {
-	const std::map<uint32_t, uint32_t>& keyframeVisibility = keyframe->getVisibility();
-	// remove visibility of point cloud
-	for (auto const &v : keyframeVisibility) {
-		SRef<CloudPoint> point;
-		if (m_pointCloudManager->getPoint(v.second, point) == FrameworkReturnCode::_SUCCESS)
-			point->removeVisibility(keyframe->getId(), v.first);
-	}
-	// remove covisibility graph
-	m_covisibilityGraph->suppressNode(keyframe->getId());
-	// remove keyframe
-	m_keyframesManager->suppressKeyframe(keyframe->getId());
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Transaction transaction;
+	transaction.removeKeyframe(keyframe);
+	applyTransaction(transaction);
 	return FrameworkReturnCode::_SUCCESS;
 }
 
@@ -223,102 +415,660 @@ void SolARMapper::pruning(const std::vector<SRef<CloudPoint>> &cloudPoints)
 		cloudPointsPruning = cloudPoints;
 	}
 
-	// check reprojection error to prune cloud points
-	int count(0);
-	for (const auto &it : cloudPointsPruning)
-		if ((it->getReprojError() > m_reprojErrorThres) || (it->getConfidence() < m_thresConfidence)) {
-			this->removeCloudPoint(it);
-			count++;
+	// check reprojection error and confidence to select the cloud points to prune, the points are split between several threads
+	const size_t minNbPointsPerTask = 10000;
+	size_t nbTasks = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), cloudPointsPruning.size() / minNbPointsPerTask));
+	size_t nbPointsPerTask = (cloudPointsPruning.size() + nbTasks - 1) / nbTasks;
+	std::vector<std::future<std::vector<SRef<CloudPoint>>>> selections;
+	for (size_t i = 0; i < nbTasks; ++i)
+		selections.push_back(std::async(nbTasks > 1 ? std::launch::async : std::launch::deferred, [&, i]() {
+			std::vector<SRef<CloudPoint>> selected;
+			size_t end = std::min(cloudPointsPruning.size(), (i + 1) * nbPointsPerTask);
+			for (size_t j = i * nbPointsPerTask; j < end; ++j) {
+				const SRef<CloudPoint> &point = cloudPointsPruning[j];
+				if ((point->getReprojError() > m_reprojErrorThres) || (point->getConfidence() < m_thresConfidence))
+					selected.push_back(point);
+			}
+			return selected;
+		}));
+	std::vector<SRef<CloudPoint>> cloudPointsToRemove;
+	for (auto &it : selections) {
+		std::vector<SRef<CloudPoint>> selected = it.get();
+		cloudPointsToRemove.insert(cloudPointsToRemove.end(), selected.begin(), selected.end());
+	}
+
+	// remove them at once
+	Transaction transaction;
+	for (const auto &it : cloudPointsToRemove)
+		transaction.removeCloudPoint(it);
+	applyTransaction(transaction);
+	m_lastPruningNbPoints = cloudPointsToRemove.size();
+	m_lastPruningTime = std::chrono::steady_clock::now().time_since_epoch().count();
+	LOG_DEBUG("Number pruning cloud points: {}", cloudPointsToRemove.size());
+}
+
+void SolARMapper::applyTransaction(const Transaction & transaction)
+{
+	if (transaction.size() == 0)
+		return;
+	// keyframes modified by the transaction, each keyframe is only got once
+	std::map<uint32_t, SRef<Keyframe>> keyframes;
+	auto getKeyframe = [&](uint32_t id) {
+		auto itKeyframe = keyframes.find(id);
+		if (itKeyframe == keyframes.end()) {
+			SRef<Keyframe> keyframe;
+			if (m_keyframesManager->getKeyframe(id, keyframe) != FrameworkReturnCode::_SUCCESS)
+				keyframe = nullptr;
+			itKeyframe = keyframes.insert(std::make_pair(id, keyframe)).first;
 		}
+		return itKeyframe->second;
+	};
+	// covisibility changes of each keyframe pair, applied once at the end
+	std::unordered_map<uint64_t, float> covisibilityChanges;
+	auto accumulateCovisibility = [&](const std::vector<uint32_t> &keyframeIds, float weight) {
+		for (size_t i = 0; i + 1 < keyframeIds.size(); i++)
+			for (size_t j = i + 1; j < keyframeIds.size(); j++) {
+				uint32_t id1 = std::min(keyframeIds[i], keyframeIds[j]);
+				uint32_t id2 = std::max(keyframeIds[i], keyframeIds[j]);
+				covisibilityChanges[(static_cast<uint64_t>(id1) << 32) | id2] += weight;
+			}
+	};
+	std::set<uint32_t> changedPointIds;
+	std::set<uint32_t> changedKeyframeIds;
 
-	LOG_DEBUG("Number pruning cloud points: {}", count);
+	// remove keyframes and their visibilities of the point cloud
+	for (const auto &keyframe : transaction.m_removedKeyframes) {
+		for (auto const &v : keyframe->getVisibility()) {
+			SRef<CloudPoint> point;
+			if (m_pointCloudManager->getPoint(v.second, point) == FrameworkReturnCode::_SUCCESS) {
+				point->removeVisibility(keyframe->getId(), v.first);
+				changedPointIds.insert(v.second);
+			}
+		}
+		m_covisibilityGraph->suppressNode(keyframe->getId());
+		m_keyframesManager->suppressKeyframe(keyframe->getId());
+		changedKeyframeIds.insert(keyframe->getId());
+	}
+
+	// remove cloud points and their visibilities of the keyframes
+	std::vector<uint32_t> removedPointIds;
+	removedPointIds.reserve(transaction.m_removedPoints.size());
+	for (const auto &cloudPoint : transaction.m_removedPoints) {
+		std::vector<uint32_t> keyframeIds;
+		for (auto const &v : cloudPoint->getVisibility()) {
+			SRef<Keyframe> keyframe = getKeyframe(v.first);
+			if (keyframe) {
+				keyframeIds.push_back(v.first);
+				keyframe->removeVisibility(v.second, cloudPoint->getId());
+				changedKeyframeIds.insert(v.first);
+			}
+		}
+		accumulateCovisibility(keyframeIds, -1.f);
+		removedPointIds.push_back(cloudPoint->getId());
+		changedPointIds.insert(cloudPoint->getId());
+	}
+	if (!removedPointIds.empty() && (m_pointCloudManager->suppressPoints(removedPointIds) != FrameworkReturnCode::_SUCCESS))
+		for (const auto &it : removedPointIds)
+			if (m_pointCloudManager->isExistPoint(it))
+				m_pointCloudManager->suppressPoint(it);
+
+	// add cloud points, their ids are set by the point cloud manager, and their visibilities to the keyframes
+	if (!transaction.m_addedPoints.empty())
+		m_pointCloudManager->addPoints(transaction.m_addedPoints);
+	for (const auto &cloudPoint : transaction.m_addedPoints) {
+		std::vector<uint32_t> keyframeIds;
+		for (auto const &v : cloudPoint->getVisibility()) {
+			SRef<Keyframe> keyframe = getKeyframe(v.first);
+			if (keyframe) {
+				keyframeIds.push_back(v.first);
+				keyframe->addVisibility(v.second, cloudPoint->getId());
+				changedKeyframeIds.insert(v.first);
+			}
+		}
+		accumulateCovisibility(keyframeIds, 1.f);
+		changedPointIds.insert(cloudPoint->getId());
+	}
+
+	// add observations of cloud points of the map, the point is got again since it may have been cloned since the transaction began
+	for (const auto &observation : transaction.m_addedObservations) {
+		const uint32_t pointId = std::get<0>(observation)->getId();
+		const uint32_t keyframeId = std::get<1>(observation);
+		const uint32_t keypointIndex = std::get<2>(observation);
+		SRef<CloudPoint> point;
+		if (m_pointCloudManager->getPoint(pointId, point) != FrameworkReturnCode::_SUCCESS)
+			continue;
+		SRef<Keyframe> keyframe = getKeyframe(keyframeId);
+		if (!keyframe || (point->getVisibility().count(keyframeId) > 0) || (keyframe->getVisibility().count(keypointIndex) > 0))
+			continue;
+		std::vector<uint32_t> keyframeIds;
+		for (const auto &v : point->getVisibility())
+			keyframeIds.push_back(v.first);
+		// only the pairs with the new observing keyframe are increased
+		for (const auto &id : keyframeIds)
+			accumulateCovisibility({ id, keyframeId }, 1.f);
+		point->addVisibility(keyframeId, keypointIndex);
+		keyframe->addVisibility(keypointIndex, pointId);
+		changedPointIds.insert(pointId);
+		changedKeyframeIds.insert(keyframeId);
+	}
+
+	// update covisibility graph
+	for (const auto &it : covisibilityChanges) {
+		uint32_t id1 = static_cast<uint32_t>(it.first >> 32);
+		uint32_t id2 = static_cast<uint32_t>(it.first & 0xFFFFFFFF);
+		if (it.second > 0.f)
+			m_covisibilityGraph->increaseEdge(id1, id2, it.second);
+		else if (it.second < 0.f)
+			m_covisibilityGraph->decreaseEdge(id1, id2, -it.second);
+	}
+	notifyChanges(std::vector<uint32_t>(changedPointIds.begin(), changedPointIds.end()),
+				  std::vector<uint32_t>(changedKeyframeIds.begin(), changedKeyframeIds.end()));
+}
+
+void SolARMapper::evict()
+{
+	Transaction transaction;
+	int nbEvictions(0);
+	// the keyframes are evicted first, their points become less observed
+	int nbKeyframes = m_keyframesManager->getNbKeyframes();
+	if ((m_maxNbKeyframes > 0) && (nbKeyframes > m_maxNbKeyframes)) {
+		if (m_keyframeEvictionQueue.empty())
+			computeKeyframeEvictionQueue(nbKeyframes - static_cast<int>(EVICTION_TARGET_RATIO * m_maxNbKeyframes));
+		while (!m_keyframeEvictionQueue.empty() && (nbEvictions < m_maxNbEvictionsPerCall)) {
+			// the reference keyframes of the tracking sessions are pinned
+			SRef<Keyframe> keyframe;
+			if (!isPinnedKeyframe(m_keyframeEvictionQueue.front()) &&
+				(m_keyframesManager->getKeyframe(m_keyframeEvictionQueue.front(), keyframe) == FrameworkReturnCode::_SUCCESS)) {
+				transaction.removeKeyframe(keyframe);
+				nbEvictions++;
+			}
+			m_keyframeEvictionQueue.pop_front();
+		}
+	}
+	else
+		resetKeyframeEviction();
+	int nbPoints = m_pointCloudManager->getNbPoints();
+	if ((m_maxNbPoints > 0) && (nbPoints > m_maxNbPoints)) {
+		if (m_pointEvictionQueue.empty())
+			computePointEvictionQueue(nbPoints - static_cast<int>(EVICTION_TARGET_RATIO * m_maxNbPoints));
+		while (!m_pointEvictionQueue.empty() && (nbEvictions < m_maxNbEvictionsPerCall)) {
+			SRef<CloudPoint> point;
+			if (m_pointCloudManager->getPoint(m_pointEvictionQueue.front(), point) == FrameworkReturnCode::_SUCCESS) {
+				transaction.removeCloudPoint(point);
+				nbEvictions++;
+			}
+			m_pointEvictionQueue.pop_front();
+		}
+	}
+	else
+		resetPointEviction();
+	if (transaction.size() == 0)
+		return;
+	LOG_DEBUG("Evict {} keyframes and {} cloud points", transaction.m_removedKeyframes.size(), transaction.m_removedPoints.size());
+	applyTransaction(transaction);
+	// the keyframe retriever cannot suppress the evicted keyframes, it is rebuilt with the remaining ones
+	m_nbEvictedRetrieverKeyframes += static_cast<int>(transaction.m_removedKeyframes.size());
+	if ((m_nbEvictedRetrieverKeyframes > 0) &&
+		(m_nbEvictedRetrieverKeyframes >= EVICTION_RETRIEVER_REBUILD_RATIO * m_keyframesManager->getNbKeyframes()))
+		rebuildEvictedKeyframeRetriever();
+}
+
+void SolARMapper::rebuildEvictedKeyframeRetriever()
+{
+	if (!m_retrieverBuilder && !m_isRetrieverBuilderUnavailable) {
+		try {
+			m_retrieverBuilder = xpcf::getComponentManagerInstance()->resolve<IKeyframeRetriever>();
+		}
+		catch (const std::exception &e) {
+			LOG_WARNING("Cannot resolve a keyframe retriever to rebuild the keyframe retriever of the map: {}", e.what());
+		}
+		if (!m_retrieverBuilder || (m_retrieverBuilder == m_keyframeRetriever)) {
+			LOG_WARNING("No distinct keyframe retriever to rebuild the keyframe retriever of the map, it keeps the evicted keyframes");
+			m_retrieverBuilder = nullptr;
+			m_isRetrieverBuilderUnavailable = true;
+		}
+	}
+	if (!m_retrieverBuilder)
+		return;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<SRef<Keyframe>> keyframes;
+	m_keyframesManager->getAllKeyframes(keyframes);
+	std::sort(keyframes.begin(), keyframes.end(), [](const SRef<Keyframe> &k1, const SRef<Keyframe> &k2) { return k1->getId() < k2->getId(); });
+	// a failed rebuild is not retried before as many evictions
+	int nbEvictedKeyframes = m_nbEvictedRetrieverKeyframes;
+	m_nbEvictedRetrieverKeyframes = 0;
+	if (rebuildKeyframeRetriever(m_retrieverBuilder, keyframes) != FrameworkReturnCode::_SUCCESS)
+		return;
+	LOG_INFO("Keyframe retriever rebuilt in {} ms without {} evicted keyframes",
+		static_cast<int>(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), nbEvictedKeyframes);
+}
+
+// keep the n smallest candidates, the candidates are only selected once they are twice as many to amortize the selection
+template <typename T>
+static void keepBestCandidates(std::vector<T> &candidates, const size_t n)
+{
+	if (candidates.size() <= 2 * n)
+		return;
+	std::nth_element(candidates.begin(), candidates.begin() + n, candidates.end());
+	candidates.resize(n);
+}
+
+void SolARMapper::computePointEvictionQueue(const int nbPoints)
+{
+	// score the next points in the order of their ids, the queue is only filled once all the points have been scored
+	std::vector<SRef<CloudPoint>> points;
+	bool isScanDone(true);
+	SRef<SolARPointCloudManager> pointCloudManager = std::dynamic_pointer_cast<SolARPointCloudManager>(m_pointCloudManager);
+	if (pointCloudManager) {
+		pointCloudManager->getPointsFrom(m_pointEvictionCursor, EVICTION_SCAN_NB_POINTS, points);
+		isScanDone = (points.size() < EVICTION_SCAN_NB_POINTS);
+		if (!points.empty())
+			m_pointEvictionCursor = points.back()->getId() + 1;
+	}
+	else
+		m_pointCloudManager->getAllPoints(points);
+	// the least recently observed points first, the keyframe ids increase with time, then the lowest confidence
+	const size_t nbEvictions = static_cast<size_t>(std::max(0, nbPoints));
+	for (const auto &point : points) {
+		const std::map<uint32_t, uint32_t> &visibility = point->getVisibility();
+		int64_t lastObservation = visibility.empty() ? -1 : static_cast<int64_t>(visibility.rbegin()->first);
+		m_pointEvictionCandidates.push_back(std::make_tuple(lastObservation, point->getConfidence(), point->getId()));
+	}
+	keepBestCandidates(m_pointEvictionCandidates, nbEvictions);
+	if (!isScanDone)
+		return;
+	std::sort(m_pointEvictionCandidates.begin(), m_pointEvictionCandidates.end());
+	for (size_t i = 0; i < std::min(nbEvictions, m_pointEvictionCandidates.size()); ++i)
+		m_pointEvictionQueue.push_back(std::get<2>(m_pointEvictionCandidates[i]));
+	m_pointEvictionCandidates.clear();
+	m_pointEvictionCursor = 0;
+}
+
+void SolARMapper::computeKeyframeEvictionQueue(const int nbKeyframes)
+{
+	// score the next keyframes in the order of their ids, the queue is only filled once all the keyframes have been scored
+	std::vector<SRef<Keyframe>> keyframes;
+	bool isScanDone(true);
+	SRef<SolARKeyframesManager> keyframesManager = std::dynamic_pointer_cast<SolARKeyframesManager>(m_keyframesManager);
+	if (keyframesManager) {
+		keyframesManager->getKeyframesFrom(m_keyframeEvictionCursor, EVICTION_SCAN_NB_KEYFRAMES, keyframes);
+		isScanDone = (keyframes.size() < EVICTION_SCAN_NB_KEYFRAMES);
+		if (!keyframes.empty())
+			m_keyframeEvictionCursor = keyframes.back()->getId() + 1;
+	}
+	else {
+		m_keyframesManager->getAllKeyframes(keyframes);
+		std::sort(keyframes.begin(), keyframes.end(), [](const SRef<Keyframe> &k1, const SRef<Keyframe> &k2) { return k1->getId() < k2->getId(); });
+	}
+	// the keyframes whose points are the most observed by other keyframes are the most redundant, then the least recent ones first
+	const size_t nbEvictions = static_cast<size_t>(std::max(0, nbKeyframes));
+	for (const auto &keyframe : keyframes) {
+		const std::map<uint32_t, uint32_t> &visibility = keyframe->getVisibility();
+		int nbRedundantPoints(0);
+		for (const auto &v : visibility) {
+			SRef<CloudPoint> point;
+			if ((m_pointCloudManager->getPoint(v.second, point) == FrameworkReturnCode::_SUCCESS) &&
+				(point->getVisibility().size() > EVICTION_REDUNDANT_OBSERVATIONS))
+				nbRedundantPoints++;
+		}
+		float redundancy = visibility.empty() ? 1.f : static_cast<float>(nbRedundantPoints) / visibility.size();
+		// the most recent keyframes are used by tracking and mapping, they only become candidates once more recent ones have been scored
+		m_recentKeyframeScores.push_back(std::make_tuple(-redundancy, keyframe->getId()));
+		if (m_recentKeyframeScores.size() > EVICTION_PROTECTED_KEYFRAMES) {
+			m_keyframeEvictionCandidates.push_back(m_recentKeyframeScores.front());
+			m_recentKeyframeScores.pop_front();
+		}
+	}
+	keepBestCandidates(m_keyframeEvictionCandidates, nbEvictions);
+	if (!isScanDone)
+		return;
+	std::sort(m_keyframeEvictionCandidates.begin(), m_keyframeEvictionCandidates.end());
+	for (size_t i = 0; i < std::min(nbEvictions, m_keyframeEvictionCandidates.size()); ++i)
+		m_keyframeEvictionQueue.push_back(std::get<1>(m_keyframeEvictionCandidates[i]));
+	m_keyframeEvictionCandidates.clear();
+	m_recentKeyframeScores.clear();
+	m_keyframeEvictionCursor = 0;
+}
+
+void SolARMapper::resetPointEviction()
+{
+	m_pointEvictionQueue.clear();
+	m_pointEvictionCandidates.clear();
+	m_pointEvictionCursor = 0;
+}
+
+void SolARMapper::resetKeyframeEviction()
+{
+	m_keyframeEvictionQueue.clear();
+	m_keyframeEvictionCandidates.clear();
+	m_recentKeyframeScores.clear();
+	m_keyframeEvictionCursor = 0;
+}
+
+void SolARMapper::pinKeyframe(const uint32_t id)
+{
+	std::unique_lock<std::mutex> lock(m_pinnedKeyframesMutex);
+	m_pinnedKeyframes[id]++;
+}
+
+void SolARMapper::unpinKeyframe(const uint32_t id)
+{
+	std::unique_lock<std::mutex> lock(m_pinnedKeyframesMutex);
+	auto it = m_pinnedKeyframes.find(id);
+	if ((it != m_pinnedKeyframes.end()) && (--it->second <= 0))
+		m_pinnedKeyframes.erase(it);
+}
+
+void SolARMapper::updateConfidences(const std::vector<SRef<CloudPoint>> &cloudPoints, const std::vector<bool> &isInliers)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (size_t i = 0; i < cloudPoints.size(); ++i) {
+		// the point is got again since it may have been cloned since it was matched
+		SRef<CloudPoint> point;
+		if (m_pointCloudManager->getPoint(cloudPoints[i]->getId(), point) == FrameworkReturnCode::_SUCCESS)
+			point->updateConfidence(isInliers[i]);
+	}
+}
+
+bool SolARMapper::isPinnedKeyframe(const uint32_t id) const
+{
+	std::unique_lock<std::mutex> lock(m_pinnedKeyframesMutex);
+	return m_pinnedKeyframes.count(id) > 0;
+}
+
+FrameworkReturnCode SolARMapper::rebuildKeyframeRetriever(const SRef<IKeyframeRetriever>& keyframeRetriever, const std::vector<SRef<Keyframe>>& keyframes)
+{
+	if (!keyframeRetriever || !m_keyframeRetriever || (keyframeRetriever == m_keyframeRetriever))
+		return FrameworkReturnCode::_ERROR_;
+	// the keyframe retriever of the map is held by other components and cannot be cleared, it loads the rebuilt one
+	boost::system::error_code ec;
+	boost::filesystem::path tmpDirectory = boost::filesystem::temp_directory_path(ec);
+	if (ec)
+		return FrameworkReturnCode::_ERROR_;
+	boost::filesystem::path emptyFile = tmpDirectory / boost::filesystem::unique_path("solar_retriever_%%%%-%%%%-%%%%.bin");
+	boost::filesystem::path rebuiltFile = tmpDirectory / boost::filesystem::unique_path("solar_retriever_%%%%-%%%%-%%%%.bin");
+	if (keyframeRetriever->saveToFile(emptyFile.string()) != FrameworkReturnCode::_SUCCESS) {
+		LOG_ERROR("Cannot save the keyframe retriever to {}", emptyFile.string());
+		boost::filesystem::remove(emptyFile, ec);
+		return FrameworkReturnCode::_ERROR_;
+	}
+	for (const auto &keyframe : keyframes)
+		keyframeRetriever->addKeyframe(keyframe);
+	FrameworkReturnCode status = keyframeRetriever->saveToFile(rebuiltFile.string());
+	if (status == FrameworkReturnCode::_SUCCESS)
+		status = m_keyframeRetriever->loadFromFile(rebuiltFile.string());
+	if (status != FrameworkReturnCode::_SUCCESS)
+		LOG_ERROR("Cannot rebuild the keyframe retriever of the map");
+	// the given keyframe retriever is emptied, it can be used again
+	keyframeRetriever->loadFromFile(emptyFile.string());
+	boost::filesystem::remove(emptyFile, ec);
+	boost::filesystem::remove(rebuiltFile, ec);
+	return status;
+}
+
+// run the save or load tasks of the map components concurrently and log the time spent by each one
+static FrameworkReturnCode runMapComponentTasks(const std::string &operation, const std::vector<std::pair<std::string, std::function<FrameworkReturnCode()>>> &tasks)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::future<std::pair<FrameworkReturnCode, double>>> results;
+	for (const auto &task : tasks)
+		results.push_back(std::async(std::launch::async, [&task]() {
+			auto startTask = std::chrono::steady_clock::now();
+			FrameworkReturnCode res;
+			try {
+				res = task.second();
+			}
+			catch (const std::exception &e) {
+				LOG_ERROR("{} failed: {}", task.first, e.what());
+				res = FrameworkReturnCode::_ERROR_;
+			}
+			return std::make_pair(res, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTask).count());
+		}));
+	FrameworkReturnCode status = FrameworkReturnCode::_SUCCESS;
+	std::string timings;
+	for (size_t i = 0; i < tasks.size(); ++i) {
+		auto result = results[i].get();
+		if (result.first != FrameworkReturnCode::_SUCCESS) {
+			LOG_WARNING("{} {} failed", operation, tasks[i].first);
+			status = FrameworkReturnCode::_ERROR_;
+		}
+		timings += (i == 0 ? "" : ", ") + tasks[i].first + ": " + std::to_string(static_cast<int>(result.second)) + " ms";
+	}
+	LOG_INFO("{} in {} ms ({})", operation, static_cast<int>(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), timings);
+	return status;
+}
+
+// a map component to save: its name, its file name and the function saving it to a file
+struct MapComponentSaver {
+	std::string name;
+	std::string fileName;
+	std::function<FrameworkReturnCode(const std::string&)> save;
+};
+
+template <class T> static std::function<FrameworkReturnCode(const std::string&)> getComponentSaver(const SRef<T> &component)
+{
+	return [component](const std::string &file) { return component->saveToFile(file); };
+}
+
+template <class T> static std::function<FrameworkReturnCode(const std::string&)> getArchiveSaver(const SRef<T> &object)
+{
+	return [object](const std::string &file) {
+		std::ofstream ofs(file, std::ios::binary);
+		OutputArchive oa(ofs);
+		oa << object;
+		ofs.close();
+		return ofs.fail() ? FrameworkReturnCode::_ERROR_ : FrameworkReturnCode::_SUCCESS;
+	};
+}
+
+// flush a file or a directory to the disk, the directories cannot be flushed on Windows where their renaming is journaled
+static bool syncPath(const boost::filesystem::path &path)
+{
+#if _WIN32
+	if (boost::filesystem::is_directory(path))
+		return true;
+	int fd = _open(path.string().c_str(), _O_RDWR | _O_BINARY);
+	bool isSynced = (fd >= 0) && (_commit(fd) == 0);
+	if (fd >= 0)
+		_close(fd);
+#else
+	int fd = open(path.string().c_str(), O_RDONLY);
+	bool isSynced = (fd >= 0) && (fsync(fd) == 0);
+	if (fd >= 0)
+		close(fd);
+#endif
+	if (!isSynced)
+		LOG_ERROR("Cannot flush {} to the disk", path.string());
+	return isSynced;
+}
+
+// flush the files of a directory and the directory itself to the disk
+static bool syncDirectory(const boost::filesystem::path &directory)
+{
+	boost::system::error_code ec;
+	bool isSynced(true);
+	for (boost::filesystem::recursive_directory_iterator it(directory, ec), end; !ec && (it != end); it.increment(ec))
+		isSynced = syncPath(it->path()) && isSynced;
+	return !ec && isSynced && syncPath(directory);
+}
+
+// save the map components in a temporary directory which replaces the map directory only once complete,
+// the saved files are flushed to the disk before the previous map is replaced, so a crash leaves a complete map or its backup
+static FrameworkReturnCode saveMapDirectory(const std::string &mapDirectory, const std::vector<MapComponentSaver> &savers)
+{
+	// the temporary and backup directories are siblings of the map directory, even if its path ends with a separator
+	boost::filesystem::path directory = boost::filesystem::path(mapDirectory).remove_trailing_separator();
+	boost::filesystem::path tmpDirectory(directory.string() + ".tmp");
+	boost::filesystem::path bakDirectory(directory.string() + ".bak");
+	boost::system::error_code ec;
+	boost::filesystem::remove_all(tmpDirectory, ec);
+	if (!boost::filesystem::create_directories(tmpDirectory, ec)) {
+		LOG_ERROR("Cannot create the directory {}", tmpDirectory.string());
+		return FrameworkReturnCode::_ERROR_;
+	}
+	const std::string tmpPath = tmpDirectory.string() + "/";
+	std::vector<std::pair<std::string, std::function<FrameworkReturnCode()>>> tasks;
+	for (const auto &saver : savers)
+		tasks.push_back({ saver.name, [&saver, &tmpPath]() { return saver.save(tmpPath + saver.fileName); } });
+	if ((runMapComponentTasks("Save map", tasks) != FrameworkReturnCode::_SUCCESS) || !syncDirectory(tmpDirectory)) {
+		boost::filesystem::remove_all(tmpDirectory, ec);
+		return FrameworkReturnCode::_ERROR_;
+	}
+	// the renamings are flushed with the parent directory
+	boost::filesystem::path parentDirectory = directory.has_parent_path() ? directory.parent_path() : boost::filesystem::path(".");
+	// replace the previous map, it is kept as backup until the new one is in place
+	boost::filesystem::remove_all(bakDirectory, ec);
+	if (boost::filesystem::exists(directory)) {
+		boost::filesystem::rename(directory, bakDirectory, ec);
+		if (ec) {
+			LOG_ERROR("Cannot move the previous map to {}: {}", bakDirectory.string(), ec.message());
+			return FrameworkReturnCode::_ERROR_;
+		}
+		syncPath(parentDirectory);
+	}
+	boost::filesystem::rename(tmpDirectory, directory, ec);
+	if (ec) {
+		LOG_ERROR("Cannot move the saved map to {}: {}", directory.string(), ec.message());
+		boost::filesystem::rename(bakDirectory, directory, ec);
+		return FrameworkReturnCode::_ERROR_;
+	}
+	// the backup is only removed once the new map is durably in place
+	if (!syncPath(parentDirectory))
+		return FrameworkReturnCode::_ERROR_;
+	boost::filesystem::remove_all(bakDirectory, ec);
+	return FrameworkReturnCode::_SUCCESS;
 }
 
 FrameworkReturnCode SolARMapper::saveToFile() const
+{
+	return saveToFileAsync().get();
+}
+
+std::future<FrameworkReturnCode> SolARMapper::saveToFileAsync(const std::function<void(FrameworkReturnCode)> &callback) const
 {
 	if (m_pointCloudManager->getNbPoints() == 0)
 	{
 		LOG_WARNING("Map is empty: nothing to save");
+		if (callback)
+			callback(FrameworkReturnCode::_SUCCESS);
+		std::promise<FrameworkReturnCode> result;
+		result.set_value(FrameworkReturnCode::_SUCCESS);
+		return result.get_future();
 	}
-	else
+	LOG_INFO("Saving the map to file...");
+	// take a snapshot of the map, the chunks of points and keyframes are only copied by the next access to them through the managers
+	std::vector<MapComponentSaver> savers;
 	{
-		LOG_INFO("Saving the map to file...");
-		boost::filesystem::create_directory(boost::filesystem::path(m_directory.c_str()));
-		LOG_DEBUG("Save identification");
-		std::ofstream ofs_iden(m_directory + "/" + m_identificationFileName, std::ios::binary);
-		OutputArchive oa_iden(ofs_iden);
-		oa_iden << m_identification;
-		ofs_iden.close();
-		LOG_DEBUG("Save coordinate system");
-		std::ofstream ofs_coor(m_directory + "/" + m_coordinateFileName, std::ios::binary);
-		OutputArchive oa_coor(ofs_coor);
-		oa_coor << m_coordinateSystem;
-		ofs_coor.close();
-		LOG_DEBUG("Save point cloud manager");
-		if (m_pointCloudManager->saveToFile(m_directory + "/" + m_pcManagerFileName) == FrameworkReturnCode::_ERROR_)
-			return FrameworkReturnCode::_ERROR_;
-		LOG_DEBUG("Save keyframes manager");
-		if (m_keyframesManager->saveToFile(m_directory + "/" + m_kfManagerFileName) == FrameworkReturnCode::_ERROR_)
-			return FrameworkReturnCode::_ERROR_;
-		LOG_DEBUG("Save covisibility graph");
-		if (m_covisibilityGraph->saveToFile(m_directory + "/" + m_covisGraphFileName) == FrameworkReturnCode::_ERROR_)
-			return FrameworkReturnCode::_ERROR_;
-		LOG_DEBUG("Save keyframe retriever");
-		if (m_keyframeRetriever->saveToFile(m_directory + "/" + m_kfRetrieverFileName) == FrameworkReturnCode::_ERROR_)
-			return FrameworkReturnCode::_ERROR_;
-		LOG_INFO("Save done!");
+		std::unique_lock<std::mutex> lock(m_mutex);
+		auto start = std::chrono::steady_clock::now();
+		SRef<SolARPointCloudManager> pointCloudManager = std::dynamic_pointer_cast<SolARPointCloudManager>(m_pointCloudManager);
+		SRef<SolARKeyframesManager> keyframesManager = std::dynamic_pointer_cast<SolARKeyframesManager>(m_keyframesManager);
+		SRef<SolARCovisibilityGraph> covisibilityGraph = std::dynamic_pointer_cast<SolARCovisibilityGraph>(m_covisibilityGraph);
+		savers.push_back({ "identification", m_identificationFileName, getArchiveSaver(m_identification) });
+		savers.push_back({ "coordinate system", m_coordinateFileName, getArchiveSaver(m_coordinateSystem) });
+		savers.push_back({ "point cloud manager", m_pcManagerFileName, pointCloudManager ? pointCloudManager->getSnapshotSaver() : getComponentSaver(m_pointCloudManager) });
+		savers.push_back({ "keyframes manager", m_kfManagerFileName, keyframesManager ? keyframesManager->getSnapshotSaver() : getComponentSaver(m_keyframesManager) });
+		savers.push_back({ "covisibility graph", m_covisGraphFileName, covisibilityGraph ? covisibilityGraph->getSnapshotSaver() : getComponentSaver(m_covisibilityGraph) });
+		// the keyframe retriever has no snapshot, it is saved by the background task
+		savers.push_back({ "keyframe retriever", m_kfRetrieverFileName, getComponentSaver(m_keyframeRetriever) });
+		// the save is pending from its snapshot, a compaction waits for it before renumbering the shared points and keyframes
+		{
+			std::unique_lock<std::mutex> savesLock(m_pendingSaves->mutex);
+			m_pendingSaves->nbSaves++;
+		}
+		LOG_DEBUG("Map snapshot taken in {} ms", static_cast<int>(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()));
 	}
-
-	return FrameworkReturnCode::_SUCCESS;
+	std::string directory = m_directory;
+	SRef<std::mutex> saveMutex = m_saveMutex;
+	SRef<PendingSaves> pendingSaves = m_pendingSaves;
+	// the save runs on a detached thread, so dropping the future does not wait for the end of the save
+	SRef<std::promise<FrameworkReturnCode>> result = xpcf::utils::make_shared<std::promise<FrameworkReturnCode>>();
+	std::future<FrameworkReturnCode> future = result->get_future();
+	std::thread([directory, savers, saveMutex, pendingSaves, callback, result]() {
+		// only one save at a time writes the map directory
+		std::unique_lock<std::mutex> lock(*saveMutex);
+		FrameworkReturnCode status = saveMapDirectory(directory, savers);
+		{
+			std::unique_lock<std::mutex> savesLock(pendingSaves->mutex);
+			pendingSaves->nbSaves--;
+		}
+		pendingSaves->done.notify_all();
+		if (status == FrameworkReturnCode::_SUCCESS)
+			LOG_INFO("Save done!");
+		if (callback)
+			callback(status);
+		result->set_value(status);
+	}).detach();
+	return future;
 }
 
 FrameworkReturnCode SolARMapper::loadFromFile()
 {
 	LOG_INFO("Loading the map from file...");
-	LOG_DEBUG("Load identification");
-	std::ifstream ifs_iden(m_directory + "/" + m_identificationFileName, std::ios::binary);
-	if (!ifs_iden.is_open())
-    {
-        LOG_WARNING("Cannot load map identification file with url: {}", m_directory + "/" + m_identificationFileName);
-		return FrameworkReturnCode::_ERROR_;
-    }
-	InputArchive ia_iden(ifs_iden);
-	ia_iden >> m_identification;
-	ifs_iden.close();
-	LOG_DEBUG("Load coordinate system");
-	std::ifstream ifs_coor(m_directory + "/" + m_coordinateFileName, std::ios::binary);
-	if (!ifs_coor.is_open())
-    {
-        LOG_WARNING("Cannot load map coordinate file with url: {}", m_directory + "/" + m_coordinateFileName);
-		return FrameworkReturnCode::_ERROR_;
-    }
-    InputArchive ia_coor(ifs_coor);
-	ia_coor >> m_coordinateSystem;
-	ifs_coor.close();
-	LOG_DEBUG("Load point cloud manager");
-	if (m_pointCloudManager->loadFromFile(m_directory + "/" + m_pcManagerFileName) == FrameworkReturnCode::_ERROR_)
-    {
-        LOG_WARNING("Cannot load map point cloud manager file with url: {}", m_directory + "/" + m_pcManagerFileName);
-        return FrameworkReturnCode::_ERROR_;
-    }
-	LOG_DEBUG("Load keyframes manager");
-	if (m_keyframesManager->loadFromFile(m_directory + "/" + m_kfManagerFileName) == FrameworkReturnCode::_ERROR_)
-    {
-        LOG_WARNING("Cannot load map keyframe manager file with url: {}", m_directory + "/" + m_kfManagerFileName);
-        return FrameworkReturnCode::_ERROR_;
-    }
-	LOG_DEBUG("Load covisibility graph");
-	if (m_covisibilityGraph->loadFromFile(m_directory + "/" + m_covisGraphFileName) == FrameworkReturnCode::_ERROR_)
-    {
-        LOG_WARNING("Cannot load map covisibility graph file with url: {}", m_directory + "/" + m_covisGraphFileName);
+	// recover the previous map if a save has been interrupted while replacing it
+	boost::filesystem::path directory = boost::filesystem::path(m_directory).remove_trailing_separator();
+	boost::filesystem::path bakDirectory(directory.string() + ".bak");
+	boost::system::error_code ec;
+	if (!boost::filesystem::exists(directory) && boost::filesystem::exists(bakDirectory)) {
+		LOG_WARNING("Recover the map from {}", bakDirectory.string());
+		boost::filesystem::rename(bakDirectory, directory, ec);
+	}
+	const std::string path = m_directory + "/";
+	std::vector<std::pair<std::string, std::function<FrameworkReturnCode()>>> tasks;
+	tasks.push_back({ "identification", [&]() {
+		std::ifstream ifs_iden(path + m_identificationFileName, std::ios::binary);
+		if (!ifs_iden.is_open())
+		{
+			LOG_WARNING("Cannot load map identification file with url: {}", path + m_identificationFileName);
+			return FrameworkReturnCode::_ERROR_;
+		}
+		InputArchive ia_iden(ifs_iden);
+		ia_iden >> m_identification;
+		ifs_iden.close();
+		return FrameworkReturnCode::_SUCCESS; } });
+	tasks.push_back({ "coordinate system", [&]() {
+		std::ifstream ifs_coor(path + m_coordinateFileName, std::ios::binary);
+		if (!ifs_coor.is_open())
+		{
+			LOG_WARNING("Cannot load map coordinate file with url: {}", path + m_coordinateFileName);
+			return FrameworkReturnCode::_ERROR_;
+		}
+		InputArchive ia_coor(ifs_coor);
+		ia_coor >> m_coordinateSystem;
+		ifs_coor.close();
+		return FrameworkReturnCode::_SUCCESS; } });
+	tasks.push_back({ "point cloud manager", [&]() {
+		if (m_pointCloudManager->loadFromFile(path + m_pcManagerFileName) == FrameworkReturnCode::_ERROR_)
+		{
+			LOG_WARNING("Cannot load map point cloud manager file with url: {}", path + m_pcManagerFileName);
+			return FrameworkReturnCode::_ERROR_;
+		}
+		return FrameworkReturnCode::_SUCCESS; } });
+	tasks.push_back({ "keyframes manager", [&]() {
+		if (m_keyframesManager->loadFromFile(path + m_kfManagerFileName) == FrameworkReturnCode::_ERROR_)
+		{
+			LOG_WARNING("Cannot load map keyframe manager file with url: {}", path + m_kfManagerFileName);
+			return FrameworkReturnCode::_ERROR_;
+		}
+		return FrameworkReturnCode::_SUCCESS; } });
+	tasks.push_back({ "covisibility graph", [&]() {
+		if (m_covisibilityGraph->loadFromFile(path + m_covisGraphFileName) == FrameworkReturnCode::_ERROR_)
+		{
+			LOG_WARNING("Cannot load map covisibility graph file with url: {}", path + m_covisGraphFileName);
+			return FrameworkReturnCode::_ERROR_;
+		}
+		return FrameworkReturnCode::_SUCCESS; } });
+	tasks.push_back({ "keyframe retriever", [&]() {
+		if (m_keyframeRetriever->loadFromFile(path + m_kfRetrieverFileName) == FrameworkReturnCode::_ERROR_)
+		{
+			LOG_WARNING("Cannot load map keyframe retriever file with url: {}", path + m_kfRetrieverFileName);
+			return FrameworkReturnCode::_ERROR_;
+		}
+		return FrameworkReturnCode::_SUCCESS; } });
+	FrameworkReturnCode status = runMapComponentTasks("Load map", tasks);
+	notifyReset();
+	if (status != FrameworkReturnCode::_SUCCESS)
 		return FrameworkReturnCode::_ERROR_;
-    }
-	LOG_DEBUG("Load keyframe retriever");
-	if (m_keyframeRetriever->loadFromFile(m_directory + "/" + m_kfRetrieverFileName) == FrameworkReturnCode::_ERROR_)
-    {
-        LOG_WARNING("Cannot load map keyframe retriever file with url: {}", m_directory + "/" + m_kfRetrieverFileName);
-        return FrameworkReturnCode::_ERROR_;
-    }
 	if (m_pointCloudManager->getNbPoints() == 0)
 	{
 		LOG_WARNING("Loaded map is empty");
@@ -332,12 +1082,517 @@ FrameworkReturnCode SolARMapper::set(const SRef<IMapper> floating_mapper) {
 	floating_mapper->getKeyframeRetriever(m_keyframeRetriever);
 	floating_mapper->getPointCloudManager(m_pointCloudManager);
 	floating_mapper->getCovisibilityGraph(m_covisibilityGraph);
+	m_nbEvictedRetrieverKeyframes = 0;
+	notifyReset();
 
 	return FrameworkReturnCode::_SUCCESS;
 }
 
 FrameworkReturnCode SolARMapper::get(SRef<IMapper> & mapper) {
-    return FrameworkReturnCode::_NOT_IMPLEMENTED;
+	// the keyframe retriever cannot be cloned, a new one is resolved with the same configuration
+	SRef<IKeyframeRetriever> keyframeRetriever;
+	try {
+		keyframeRetriever = xpcf::getComponentManagerInstance()->resolve<IKeyframeRetriever>();
+	}
+	catch (const std::exception &e) {
+		LOG_ERROR("Cannot resolve a keyframe retriever for the fork: {}", e.what());
+		return FrameworkReturnCode::_ERROR_;
+	}
+	return fork(mapper, keyframeRetriever);
+}
+
+FrameworkReturnCode SolARMapper::fork(SRef<IMapper> & mapper, const SRef<IKeyframeRetriever> keyframeRetriever) {
+	if (!keyframeRetriever || (keyframeRetriever == m_keyframeRetriever)) {
+		LOG_ERROR("The fork needs its own keyframe retriever, the keyframes of both maps would be retrieved with the same ids");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	std::unique_lock<std::mutex> lock(m_mutex);
+	SRef<SolARPointCloudManager> pointCloudManager = std::dynamic_pointer_cast<SolARPointCloudManager>(m_pointCloudManager);
+	SRef<SolARKeyframesManager> keyframesManager = std::dynamic_pointer_cast<SolARKeyframesManager>(m_keyframesManager);
+	if (!pointCloudManager || !keyframesManager) {
+		LOG_ERROR("The map can only be forked with SolARPointCloudManager and SolARKeyframesManager components");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	auto start = std::chrono::steady_clock::now();
+	SRef<SolARMapper> fork = std::dynamic_pointer_cast<SolARMapper>(xpcf::ComponentFactory::createInstance<SolARMapper>()->bindTo<IMapper>());
+	// the point cloud and the keyframes are shared
+	SRef<SolARPointCloudManager> forkPointCloudManager = std::dynamic_pointer_cast<SolARPointCloudManager>(xpcf::ComponentFactory::createInstance<SolARPointCloudManager>()->bindTo<IPointCloudManager>());
+	forkPointCloudManager->shareFrom(*pointCloudManager);
+	SRef<SolARKeyframesManager> forkKeyframesManager = std::dynamic_pointer_cast<SolARKeyframesManager>(xpcf::ComponentFactory::createInstance<SolARKeyframesManager>()->bindTo<IKeyframesManager>());
+	forkKeyframesManager->shareFrom(*keyframesManager);
+	// the covisibility graph is copied
+	SRef<ICovisibilityGraph> forkCovisibilityGraph = xpcf::ComponentFactory::createInstance<SolARCovisibilityGraph>()->bindTo<ICovisibilityGraph>();
+	std::set<uint32_t> nodes;
+	m_covisibilityGraph->getAllNodes(nodes);
+	size_t nbEdges(0);
+	for (const auto &node : nodes) {
+		std::vector<uint32_t> neighbors;
+		m_covisibilityGraph->getNeighbors(node, 0.f, neighbors);
+		for (const auto &neighbor : neighbors) {
+			float weight;
+			if ((neighbor > node) && (m_covisibilityGraph->getEdge(node, neighbor, weight) == FrameworkReturnCode::_SUCCESS)) {
+				forkCovisibilityGraph->increaseEdge(node, neighbor, weight);
+				nbEdges++;
+			}
+		}
+	}
+	fork->setIdentification(m_identification);
+	fork->setCoordinateSystem(m_coordinateSystem);
+	fork->setPointCloudManager(forkPointCloudManager);
+	fork->setKeyframesManager(forkKeyframesManager);
+	fork->setCovisibilityGraph(forkCovisibilityGraph);
+	// the keyframe retriever of the fork is rebuilt with the shared keyframes
+	std::vector<SRef<Keyframe>> keyframes;
+	keyframesManager->getAllKeyframes(keyframes);
+	std::sort(keyframes.begin(), keyframes.end(), [](const SRef<Keyframe> &k1, const SRef<Keyframe> &k2) { return k1->getId() < k2->getId(); });
+	for (const auto &keyframe : keyframes)
+		keyframeRetriever->addKeyframe(keyframe);
+	fork->setKeyframeRetriever(keyframeRetriever);
+	fork->m_directory = m_directory;
+	fork->m_identificationFileName = m_identificationFileName;
+	fork->m_coordinateFileName = m_coordinateFileName;
+	fork->m_pcManagerFileName = m_pcManagerFileName;
+	fork->m_kfManagerFileName = m_kfManagerFileName;
+	fork->m_covisGraphFileName = m_covisGraphFileName;
+	fork->m_kfRetrieverFileName = m_kfRetrieverFileName;
+	fork->m_reprojErrorThres = m_reprojErrorThres;
+	fork->m_thresConfidence = m_thresConfidence;
+	fork->m_changeFeedSize = m_changeFeedSize;
+	fork->m_maxNbPoints = m_maxNbPoints;
+	fork->m_maxNbKeyframes = m_maxNbKeyframes;
+	fork->m_maxNbEvictionsPerCall = m_maxNbEvictionsPerCall;
+	// from now, the managers of both mappers clone a shared point or keyframe when it is got
+	int nbPoints = pointCloudManager->getNbPoints();
+	int nbKeyframes = keyframesManager->getNbKeyframes();
+	fork->m_sharingToken = m_sharingToken;
+	fork->m_nbClonedPointsAtFork = forkPointCloudManager->getNbClonedPoints();
+	fork->m_nbClonedKeyframesAtFork = forkKeyframesManager->getNbClonedKeyframes();
+	fork->m_forkStatistics.nbSharedPoints = nbPoints;
+	fork->m_forkStatistics.nbSharedKeyframes = nbKeyframes;
+	fork->m_forkStatistics.nbCopiedEdges = nbEdges;
+	LOG_INFO("Map forked in {} ms: {} points and {} keyframes shared, {} covisibility edges copied", 
+		static_cast<int>(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()), nbPoints, nbKeyframes, nbEdges);
+	LOG_INFO("Fork memory cost: {} KB, up to {} KB more once all the points and keyframes are cloned", fork->getForkStatistics().estimatedMemory / 1024,
+		(static_cast<size_t>(nbPoints) * sizeof(CloudPoint) + static_cast<size_t>(nbKeyframes) * sizeof(Keyframe)) / 1024);
+	mapper = fork;
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapper::getStatistics(MapStatistics & statistics) const
+{
+	if (!m_pointCloudManager || !m_keyframesManager || !m_covisibilityGraph)
+		return FrameworkReturnCode::_ERROR_;
+	// the statistics are computed from a snapshot of the points and keyframes taken under the map lock, the lock is held
+	// during the whole computation with other storage components
+	statistics = MapStatistics();
+	SRef<SolARPointCloudManager> pointCloudManager = std::dynamic_pointer_cast<SolARPointCloudManager>(m_pointCloudManager);
+	SRef<SolARKeyframesManager> keyframesManager = std::dynamic_pointer_cast<SolARKeyframesManager>(m_keyframesManager);
+	SRef<const SolARPointCloudManager::PointCloud> pointsSnapshot;
+	SRef<const SolARKeyframesManager::Keyframes> keyframesSnapshot;
+	std::vector<SRef<CloudPoint>> points;
+	std::vector<SRef<Keyframe>> keyframes;
+	std::set<uint32_t> nodes;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	statistics.mapVersion = m_mapVersion;
+	if (pointCloudManager && keyframesManager) {
+		pointsSnapshot = pointCloudManager->getSnapshot();
+		keyframesSnapshot = keyframesManager->getSnapshot();
+	}
+	else {
+		m_pointCloudManager->getAllPoints(points);
+		m_keyframesManager->getAllKeyframes(keyframes);
+	}
+	m_covisibilityGraph->getAllNodes(nodes);
+	if (pointsSnapshot)
+		lock.unlock();
+	auto forEachPoint = [&](const std::function<void(const SRef<CloudPoint>&)> &visitor) {
+		if (pointsSnapshot)
+			pointsSnapshot->forEach(visitor);
+		else
+			std::for_each(points.begin(), points.end(), visitor);
+	};
+	auto forEachKeyframe = [&](const std::function<void(const SRef<Keyframe>&)> &visitor) {
+		if (keyframesSnapshot)
+			keyframesSnapshot->forEach(visitor);
+		else
+			std::for_each(keyframes.begin(), keyframes.end(), visitor);
+	};
+	statistics.nbPoints = static_cast<int>(pointsSnapshot ? pointsSnapshot->size() : points.size());
+	statistics.nbKeyframes = static_cast<int>(keyframesSnapshot ? keyframesSnapshot->size() : keyframes.size());
+
+	auto addToHistogram = [](Histogram &histogram, double value) {
+		size_t bin = std::min(histogram.counts.size() - 1, static_cast<size_t>(std::max(0.0, value) / histogram.binWidth));
+		histogram.counts[bin]++;
+	};
+	statistics.observationsPerPoint = { 1.f, std::vector<uint32_t>(STATISTICS_NB_BINS + 1, 0) };
+	statistics.keyframeDegree = { 5.f, std::vector<uint32_t>(STATISTICS_NB_BINS + 1, 0) };
+	statistics.reprojectionError = { 2.f * m_reprojErrorThres / STATISTICS_NB_BINS, std::vector<uint32_t>(STATISTICS_NB_BINS + 1, 0) };
+	if (statistics.reprojectionError.binWidth <= 0.f)
+		statistics.reprojectionError.binWidth = 1.f;
+
+	// cloud points
+	size_t nbVisibilities(0);
+	forEachPoint([&](const SRef<CloudPoint> &point) {
+		statistics.coordinatesBytes += sizeof(CloudPoint);
+		const SRef<DescriptorBuffer> &descriptor = point->getDescriptor();
+		if (descriptor)
+			statistics.descriptorsBytes += static_cast<size_t>(descriptor->getNbDescriptors()) * descriptor->getDescriptorByteSize();
+		nbVisibilities += point->getVisibility().size();
+		addToHistogram(statistics.observationsPerPoint, static_cast<double>(point->getVisibility().size()));
+		addToHistogram(statistics.reprojectionError, point->getReprojError());
+	});
+	// keyframes, an image shared by several keyframes is only counted once
+	std::set<const Image*> images;
+	forEachKeyframe([&](const SRef<Keyframe> &keyframe) {
+		statistics.coordinatesBytes += sizeof(Keyframe) + keyframe->getKeypoints().size() * sizeof(Keypoint);
+		const SRef<DescriptorBuffer> &descriptors = keyframe->getDescriptors();
+		if (descriptors)
+			statistics.descriptorsBytes += static_cast<size_t>(descriptors->getNbDescriptors()) * descriptors->getDescriptorByteSize();
+		const SRef<Image> &image = keyframe->getView();
+		if (image && images.insert(image.get()).second)
+			statistics.imagesBytes += image->getBufferSize();
+		nbVisibilities += keyframe->getVisibility().size();
+	});
+	statistics.visibilitiesBytes = nbVisibilities * STATISTICS_VISIBILITY_SIZE;
+	// covisibility graph
+	size_t sumDegrees(0);
+	for (const auto &node : nodes) {
+		std::vector<uint32_t> neighbors;
+		m_covisibilityGraph->getNeighbors(node, 0.f, neighbors);
+		sumDegrees += neighbors.size();
+		addToHistogram(statistics.keyframeDegree, static_cast<double>(neighbors.size()));
+	}
+	statistics.nbEdges = sumDegrees / 2;
+	// last pruning
+	int64_t lastPruningTime = m_lastPruningTime;
+	if (lastPruningTime >= 0) {
+		std::chrono::steady_clock::duration age = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(lastPruningTime);
+		statistics.lastPruningAge = std::chrono::duration<double>(age).count();
+		statistics.lastPruningNbPoints = m_lastPruningNbPoints;
+	}
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARMapper::getStatistics(std::string & json) const
+{
+	MapStatistics statistics;
+	if (getStatistics(statistics) != FrameworkReturnCode::_SUCCESS)
+		return FrameworkReturnCode::_ERROR_;
+	auto histogramToJSON = [](const Histogram &histogram) {
+		std::ostringstream ss;
+		ss << "{\"bin_width\": " << histogram.binWidth << ", \"counts\": [";
+		for (size_t i = 0; i < histogram.counts.size(); ++i)
+			ss << (i > 0 ? ", " : "") << histogram.counts[i];
+		ss << "]}";
+		return ss.str();
+	};
+	std::ostringstream ss;
+	ss << "{\"map_version\": " << statistics.mapVersion
+		<< ", \"points\": " << statistics.nbPoints
+		<< ", \"keyframes\": " << statistics.nbKeyframes
+		<< ", \"edges\": " << statistics.nbEdges
+		<< ", \"bytes\": {\"coordinates\": " << statistics.coordinatesBytes
+		<< ", \"descriptors\": " << statistics.descriptorsBytes
+		<< ", \"images\": " << statistics.imagesBytes
+		<< ", \"visibilities\": " << statistics.visibilitiesBytes << "}"
+		<< ", \"observations_per_point\": " << histogramToJSON(statistics.observationsPerPoint)
+		<< ", \"keyframe_degree\": " << histogramToJSON(statistics.keyframeDegree)
+		<< ", \"reprojection_error\": " << histogramToJSON(statistics.reprojectionError)
+		<< ", \"last_pruning_age_s\": " << statistics.lastPruningAge
+		<< ", \"last_pruning_points\": " << statistics.lastPruningNbPoints << "}";
+	json = ss.str();
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+// split a range of indices between several threads
+static void parallelFor(const size_t size, const size_t minSizePerTask, const std::function<void(size_t, size_t)> &task)
+{
+	size_t nbTasks = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), size / std::max<size_t>(1, minSizePerTask)));
+	size_t sizePerTask = (size + nbTasks - 1) / nbTasks;
+	std::vector<std::future<void>> results;
+	for (size_t i = 0; i < nbTasks; ++i)
+		results.push_back(std::async(nbTasks > 1 ? std::launch::async : std::launch::deferred, [&, i]() {
+			task(std::min(size, i * sizePerTask), std::min(size, (i + 1) * sizePerTask));
+		}));
+	for (auto &it : results)
+		it.get();
+}
+
+FrameworkReturnCode SolARMapper::compact(const SRef<IKeyframeRetriever> keyframeRetriever, std::map<uint32_t, uint32_t>& pointIdMap, std::map<uint32_t, uint32_t>& keyframeIdMap)
+{
+	SRef<SolARPointCloudManager> pointCloudManager = std::dynamic_pointer_cast<SolARPointCloudManager>(m_pointCloudManager);
+	SRef<SolARKeyframesManager> keyframesManager = std::dynamic_pointer_cast<SolARKeyframesManager>(m_keyframesManager);
+	SRef<SolARCovisibilityGraph> covisibilityGraph = std::dynamic_pointer_cast<SolARCovisibilityGraph>(m_covisibilityGraph);
+	if (!pointCloudManager || !keyframesManager) {
+		LOG_ERROR("The map can only be compacted with SolARPointCloudManager and SolARKeyframesManager components");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	// the new ids and visibilities are prepared without holding the map lock, the map is checked to be unchanged once the lock is taken
+	auto start = std::chrono::steady_clock::now();
+	const uint64_t version = m_mapVersion;
+	std::vector<SRef<CloudPoint>> points;
+	std::vector<SRef<Keyframe>> keyframes;
+	m_pointCloudManager->getAllPoints(points);
+	m_keyframesManager->getAllKeyframes(keyframes);
+	std::sort(points.begin(), points.end(), [](const SRef<CloudPoint> &p1, const SRef<CloudPoint> &p2) { return p1->getId() < p2->getId(); });
+	std::sort(keyframes.begin(), keyframes.end(), [](const SRef<Keyframe> &k1, const SRef<Keyframe> &k2) { return k1->getId() < k2->getId(); });
+	// the new ids keep the order of the old ones, the keyframes are only renumbered if they can be added to a new keyframe retriever
+	// and if the covisibility graph can be renumbered with them
+	pointIdMap.clear();
+	keyframeIdMap.clear();
+	for (uint32_t i = 0; i < points.size(); ++i)
+		pointIdMap[points[i]->getId()] = i;
+	bool renumberKeyframes = (keyframeRetriever != nullptr) && (keyframeRetriever != m_keyframeRetriever) && (m_keyframeRetriever != nullptr) &&
+		(covisibilityGraph != nullptr);
+	for (uint32_t i = 0; i < keyframes.size(); ++i)
+		keyframeIdMap[keyframes[i]->getId()] = renumberKeyframes ? i : keyframes[i]->getId();
+	if (!renumberKeyframes)
+		LOG_WARNING("No new keyframe retriever or SolARCovisibilityGraph to rebuild, the keyframes are not renumbered");
+
+	// compute the new visibilities first, the points and the keyframes are only modified once they have been renumbered,
+	// the visibilities to removed points or keyframes are dropped
+	std::atomic<size_t> nbDroppedVisibilities(0);
+	std::vector<std::map<uint32_t, uint32_t>> pointVisibilities(points.size());
+	std::vector<std::map<uint32_t, uint32_t>> keyframeVisibilities(keyframes.size());
+	std::vector<size_t> pointNbVisibilities(points.size());
+	std::vector<size_t> keyframeNbVisibilities(keyframes.size());
+	parallelFor(points.size(), 1000, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const std::map<uint32_t, uint32_t> &visibility = points[i]->getVisibility();
+			pointNbVisibilities[i] = visibility.size();
+			for (const auto &v : visibility) {
+				auto it = keyframeIdMap.find(v.first);
+				if (it != keyframeIdMap.end())
+					pointVisibilities[i][it->second] = v.second;
+				else
+					nbDroppedVisibilities++;
+			}
+		}
+	});
+	parallelFor(keyframes.size(), 10, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			const std::map<uint32_t, uint32_t> &visibility = keyframes[i]->getVisibility();
+			keyframeNbVisibilities[i] = visibility.size();
+			for (const auto &v : visibility) {
+				auto it = pointIdMap.find(v.second);
+				if (it != pointIdMap.end())
+					keyframeVisibilities[i][v.first] = it->second;
+				else
+					nbDroppedVisibilities++;
+			}
+		}
+	});
+
+	// the snapshots of the background saves share the points and the keyframes, wait until they are written without holding the map,
+	// a new save takes its snapshot under the map lock so none can start once the lock is taken without pending save
+	std::unique_lock<std::mutex> lock(m_mutex, std::defer_lock);
+	while (true) {
+		{
+			std::unique_lock<std::mutex> savesLock(m_pendingSaves->mutex);
+			m_pendingSaves->done.wait(savesLock, [this]() { return m_pendingSaves->nbSaves == 0; });
+		}
+		lock.lock();
+		std::unique_lock<std::mutex> savesLock(m_pendingSaves->mutex);
+		if (m_pendingSaves->nbSaves == 0)
+			break;
+		savesLock.unlock();
+		lock.unlock();
+	}
+	auto startLock = std::chrono::steady_clock::now();
+	if (isShared()) {
+		LOG_ERROR("The map cannot be compacted while its points and keyframes are shared with a fork");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	// the visibilities can also be modified without the mapper, by the mapping for instance, their number is checked
+	std::atomic<bool> isModified((m_mapVersion != version) || (m_pointCloudManager->getNbPoints() != static_cast<int>(points.size())) ||
+		(m_keyframesManager->getNbKeyframes() != static_cast<int>(keyframes.size())));
+	if (!isModified) {
+		// the points and keyframes accessed while a snapshot was shared have been replaced by clones, they are checked to be the same instances
+		std::vector<SRef<CloudPoint>> currentPoints;
+		std::vector<SRef<Keyframe>> currentKeyframes;
+		pointCloudManager->getAllPoints(currentPoints);
+		keyframesManager->getAllKeyframes(currentKeyframes);
+		isModified = (currentPoints != points) || (currentKeyframes != keyframes);
+	}
+	if (!isModified) {
+		parallelFor(points.size(), 10000, [&](size_t begin, size_t end) {
+			for (size_t i = begin; (i < end) && !isModified; ++i)
+				if (points[i]->getVisibility().size() != pointNbVisibilities[i])
+					isModified = true;
+		});
+		for (size_t i = 0; (i < keyframes.size()) && !isModified; ++i)
+			if (keyframes[i]->getVisibility().size() != keyframeNbVisibilities[i])
+				isModified = true;
+	}
+	if (isModified) {
+		LOG_WARNING("The map has been modified during the preparation of its compaction");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	// renumber the keyframes first, they can be added without the mapper, each renumbering fails without modification
+	if (renumberKeyframes && (keyframesManager->renumber(keyframeIdMap) != FrameworkReturnCode::_SUCCESS)) {
+		LOG_ERROR("Cannot renumber the keyframes, the map has been modified during its compaction");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	// the previous ids are restored if the compaction cannot be completed
+	auto restoreIds = [&](const SRef<SolARPointCloudManager> &restoredPointCloudManager) {
+		std::map<uint32_t, uint32_t> pointIdRestoreMap, keyframeIdRestoreMap;
+		for (const auto &it : pointIdMap)
+			pointIdRestoreMap[it.second] = it.first;
+		for (const auto &it : keyframeIdMap)
+			keyframeIdRestoreMap[it.second] = it.first;
+		if ((restoredPointCloudManager && (restoredPointCloudManager->renumber(pointIdRestoreMap) != FrameworkReturnCode::_SUCCESS)) ||
+			(renumberKeyframes && (keyframesManager->renumber(keyframeIdRestoreMap) != FrameworkReturnCode::_SUCCESS))) {
+			LOG_ERROR("Cannot restore the ids of the points and the keyframes");
+			notifyReset();
+		}
+	};
+	if (pointCloudManager->renumber(pointIdMap) != FrameworkReturnCode::_SUCCESS) {
+		LOG_ERROR("Cannot renumber the points, the map has been modified during its compaction");
+		restoreIds(nullptr);
+		return FrameworkReturnCode::_ERROR_;
+	}
+	// the keyframe retriever of the map is rebuilt in place, the components holding it retrieve the new ids
+	if (renumberKeyframes && (rebuildKeyframeRetriever(keyframeRetriever, keyframes) != FrameworkReturnCode::_SUCCESS)) {
+		restoreIds(pointCloudManager);
+		return FrameworkReturnCode::_ERROR_;
+	}
+	// rewrite the visibilities
+	parallelFor(points.size(), 1000, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			std::map<uint32_t, uint32_t> visibility = points[i]->getVisibility();
+			for (const auto &v : visibility)
+				points[i]->removeVisibility(v.first, v.second);
+			for (const auto &v : pointVisibilities[i])
+				points[i]->addVisibility(v.first, v.second);
+		}
+	});
+	parallelFor(keyframes.size(), 10, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			std::map<uint32_t, uint32_t> visibility = keyframes[i]->getVisibility();
+			for (const auto &v : visibility)
+				keyframes[i]->removeVisibility(v.first, v.second);
+			for (const auto &v : keyframeVisibilities[i])
+				keyframes[i]->addVisibility(v.first, v.second);
+		}
+	});
+	// rebuild the covisibility graph with the new keyframe ids
+	if (renumberKeyframes)
+		covisibilityGraph->renumber(keyframeIdMap);
+	m_localPointCloudCache.isValid = false;
+	resetPointEviction();
+	resetKeyframeEviction();
+	if (renumberKeyframes)
+		m_nbEvictedRetrieverKeyframes = 0;
+	// the pinned keyframes follow their renumbering
+	{
+		std::unique_lock<std::mutex> pinLock(m_pinnedKeyframesMutex);
+		std::map<uint32_t, int> pinnedKeyframes;
+		for (const auto &it : m_pinnedKeyframes) {
+			auto itId = keyframeIdMap.find(it.first);
+			if (itId != keyframeIdMap.end())
+				pinnedKeyframes[itId->second] = it.second;
+		}
+		m_pinnedKeyframes.swap(pinnedKeyframes);
+	}
+	// the consumers of the map ids, such as the local maps of the tracking, are rebuilt
+	notifyReset();
+	LOG_INFO("Map compacted in {} ms, {} ms under the map lock: {} points, {} keyframes, {} dropped visibilities",
+		static_cast<int>(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()),
+		static_cast<int>(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startLock).count()),
+		points.size(), keyframes.size(), nbDroppedVisibilities.load());
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+SolARMapper::ForkStatistics SolARMapper::getForkStatistics() const
+{
+	ForkStatistics stats = m_forkStatistics;
+	SRef<SolARPointCloudManager> pointCloudManager = std::dynamic_pointer_cast<SolARPointCloudManager>(m_pointCloudManager);
+	SRef<SolARKeyframesManager> keyframesManager = std::dynamic_pointer_cast<SolARKeyframesManager>(m_keyframesManager);
+	if (pointCloudManager)
+		stats.nbClonedPoints = pointCloudManager->getNbClonedPoints() - m_nbClonedPointsAtFork;
+	if (keyframesManager)
+		stats.nbClonedKeyframes = keyframesManager->getNbClonedKeyframes() - m_nbClonedKeyframesAtFork;
+	// the cloned objects and the copied covisibility edges, the tables of the shared chunks being negligible
+	stats.estimatedMemory = stats.nbClonedPoints * sizeof(CloudPoint) + stats.nbClonedKeyframes * sizeof(Keyframe) +
+		stats.nbCopiedEdges * FORK_EDGE_SIZE;
+	return stats;
+}
+
+bool SolARMapper::isShared() const
+{
+	// the token is released by a fork when it is destroyed
+	return m_sharingToken.use_count() > 1;
+}
+
+SRef<Keyframe> SolARMapper::getWritableKeyframe(const SRef<Keyframe>& keyframe) const
+{
+	// the keyframes manager clones a keyframe shared with a fork or a snapshot when it is got
+	SRef<Keyframe> writableKeyframe;
+	if (m_keyframesManager->getKeyframe(keyframe->getId(), writableKeyframe) != FrameworkReturnCode::_SUCCESS)
+		return keyframe;
+	return writableKeyframe;
+}
+
+uint64_t SolARMapper::getMapVersion() const
+{
+	return m_mapVersion;
+}
+
+uint64_t SolARMapper::getResetVersion() const
+{
+	return m_resetVersion;
+}
+
+FrameworkReturnCode SolARMapper::getChangesSince(const uint64_t version, std::vector<uint32_t>& changedPointIds, std::vector<uint32_t>& changedKeyframeIds, uint64_t& currentVersion) const
+{
+	std::unique_lock<std::mutex> lock(m_changeFeedMutex);
+	changedPointIds.clear();
+	changedKeyframeIds.clear();
+	currentVersion = m_mapVersion;
+	if (version == currentVersion)
+		return FrameworkReturnCode::_SUCCESS;
+	// the changes are not available anymore, the consumer must rebuild its data
+	if ((version > currentVersion) || (version < m_changeFeedStartVersion))
+		return FrameworkReturnCode::_ERROR_;
+	// the entries are sorted by version
+	auto it = std::upper_bound(m_changeFeed.begin(), m_changeFeed.end(), version,
+		[](uint64_t v, const ChangeFeedEntry &entry) { return v < entry.version; });
+	for (; it != m_changeFeed.end(); ++it) {
+		changedPointIds.insert(changedPointIds.end(), it->pointIds.begin(), it->pointIds.end());
+		changedKeyframeIds.insert(changedKeyframeIds.end(), it->keyframeIds.begin(), it->keyframeIds.end());
+	}
+	std::sort(changedPointIds.begin(), changedPointIds.end());
+	changedPointIds.erase(std::unique(changedPointIds.begin(), changedPointIds.end()), changedPointIds.end());
+	std::sort(changedKeyframeIds.begin(), changedKeyframeIds.end());
+	changedKeyframeIds.erase(std::unique(changedKeyframeIds.begin(), changedKeyframeIds.end()), changedKeyframeIds.end());
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+void SolARMapper::notifyChanges(const std::vector<uint32_t>& pointIds, const std::vector<uint32_t>& keyframeIds)
+{
+	std::unique_lock<std::mutex> lock(m_changeFeedMutex);
+	uint64_t version = ++m_mapVersion;
+	if (m_changeFeedSize <= 0) {
+		m_changeFeedStartVersion = version;
+		return;
+	}
+	m_changeFeed.push_back({ version, pointIds, keyframeIds });
+	m_changeFeedNbIds += pointIds.size() + keyframeIds.size();
+	// drop the oldest changes, the changes since their version are not available anymore
+	while ((m_changeFeed.size() > 1) && (m_changeFeedNbIds > static_cast<size_t>(m_changeFeedSize))) {
+		m_changeFeedNbIds -= m_changeFeed.front().pointIds.size() + m_changeFeed.front().keyframeIds.size();
+		m_changeFeedStartVersion = m_changeFeed.front().version;
+		m_changeFeed.pop_front();
+	}
+}
+
+void SolARMapper::notifyReset()
+{
+	std::unique_lock<std::mutex> lock(m_changeFeedMutex);
+	m_changeFeedStartVersion = ++m_mapVersion;
+	m_resetVersion = m_changeFeedStartVersion;
+	m_changeFeed.clear();
+	m_changeFeedNbIds = 0;
 }
 
 }
@@ -82,7 +82,8 @@ FrameworkReturnCode SolAROverlapDetector::detect(const SRef<api::solver::map::IM
 		std::vector<SRef<Keyframe>> candidateKeyframes;
 		for (auto &it : candidatesId) {
 			SRef<Keyframe> keyframe;
-			globalKeyframesManager->getKeyframe(it, keyframe);
+			if (globalKeyframesManager->getKeyframe(it, keyframe) != FrameworkReturnCode::_SUCCESS)
+				continue;
 			candidateKeyframes.push_back(keyframe);
 		}
 		// find best candidate loop detection
@@ -182,7 +183,8 @@ FrameworkReturnCode SolAROverlapDetector::detect(const SRef<api::solver::map::IM
 		std::vector<SRef<Keyframe>> candidateKeyframes;
 		for (auto &it : candidatesId) {
 			SRef<Keyframe> keyframe;
-			globalKeyframesManager->getKeyframe(it, keyframe);
+			if (globalKeyframesManager->getKeyframe(it, keyframe) != FrameworkReturnCode::_SUCCESS)
+				continue;
 			candidateKeyframes.push_back(keyframe);
 		}
 		// find best candidate loop detection
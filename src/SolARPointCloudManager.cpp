@@ -37,7 +37,7 @@ FrameworkReturnCode SolARPointCloudManager::addPoint(const SRef<CloudPoint> poin
 {
 	std::unique_lock<std::mutex> lock(m_mutex);
 	point->setId(m_id);	
-	m_pointCloud[m_id] = point;
+	m_pointCloud.set(m_id, point);
 	m_id++;
 	return FrameworkReturnCode::_SUCCESS;
 }
@@ -47,7 +47,7 @@ FrameworkReturnCode SolARPointCloudManager::addPoints(const std::vector<SRef<Clo
 	std::unique_lock<std::mutex> lock(m_mutex);
 	for (auto &it : points) {
 		it->setId(m_id);
-		m_pointCloud[m_id] = it;
+		m_pointCloud.set(m_id, it);
 		m_id++;
 	}
 	return FrameworkReturnCode::_SUCCESS;
@@ -58,7 +58,7 @@ FrameworkReturnCode SolARPointCloudManager::addPoint(const CloudPoint & point)
 	std::unique_lock<std::mutex> lock(m_mutex);
     SRef<CloudPoint> point_ptr = xpcf::utils::make_shared<CloudPoint>(point);
 	point_ptr->setId(m_id);
-	m_pointCloud[m_id] = point_ptr;
+	m_pointCloud.set(m_id, point_ptr);
 	m_id++;
 	return FrameworkReturnCode::_SUCCESS;
 }
@@ -69,7 +69,7 @@ FrameworkReturnCode SolARPointCloudManager::addPoints(const std::vector<CloudPoi
 	for (auto &it : points) {
         SRef<CloudPoint> point_ptr = xpcf::utils::make_shared<CloudPoint>(it);
 		point_ptr->setId(m_id);
-		m_pointCloud[m_id] = point_ptr;
+		m_pointCloud.set(m_id, point_ptr);
 		m_id++;
 	}
 	return FrameworkReturnCode::_SUCCESS;
@@ -78,9 +78,9 @@ FrameworkReturnCode SolARPointCloudManager::addPoints(const std::vector<CloudPoi
 FrameworkReturnCode SolARPointCloudManager::getPoint(const uint32_t id, SRef<CloudPoint>& point) const
 {
     std::unique_lock<std::mutex> lock(m_mutex);
-    std::map< uint32_t, SRef<CloudPoint>>::const_iterator pointIt = m_pointCloud.find(id);
-	if (pointIt != m_pointCloud.end()) {
-		point = pointIt->second;
+	SRef<CloudPoint> storedPoint = m_pointCloud.get(id);
+	if (storedPoint) {
+		point = storedPoint;
 		return FrameworkReturnCode::_SUCCESS;
 	}
 	else {
@@ -93,12 +93,12 @@ FrameworkReturnCode SolARPointCloudManager::getPoints(const std::vector<uint32_t
 {
     std::unique_lock<std::mutex> lock(m_mutex);
 	for (auto &it : ids) {
-        std::map< uint32_t, SRef<CloudPoint>>::const_iterator pointIt = m_pointCloud.find(it);
-		if (pointIt == m_pointCloud.end()) {
+		SRef<CloudPoint> point = m_pointCloud.get(it);
+		if (!point) {
 			LOG_DEBUG("Cannot find cloud point with id {} to get", it);
 			return FrameworkReturnCode::_ERROR_;
 		}
-		points.push_back(pointIt->second);
+		points.push_back(point);
 	}
 	return FrameworkReturnCode::_SUCCESS;
 }
@@ -106,19 +106,22 @@ FrameworkReturnCode SolARPointCloudManager::getPoints(const std::vector<uint32_t
 FrameworkReturnCode SolARPointCloudManager::getAllPoints(std::vector<SRef<CloudPoint>>& points) const
 {
     std::unique_lock<std::mutex> lock(m_mutex);
-	for (auto pointIt = m_pointCloud.begin(); pointIt != m_pointCloud.end(); pointIt++)
-		points.push_back(pointIt->second);
+	m_pointCloud.getAll(points);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARPointCloudManager::getPointsFrom(const uint32_t firstId, const uint32_t maxNbPoints, std::vector<SRef<CloudPoint>>& points) const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_pointCloud.getFrom(firstId, maxNbPoints, points);
 	return FrameworkReturnCode::_SUCCESS;
 }
 
 FrameworkReturnCode SolARPointCloudManager::suppressPoint(const uint32_t id)
 {
 	std::unique_lock<std::mutex> lock(m_mutex);
-	std::map< uint32_t, SRef<CloudPoint>>::iterator pointIt = m_pointCloud.find(id);
-	if (pointIt != m_pointCloud.end()) {
-		m_pointCloud.erase(pointIt);
+	if (m_pointCloud.erase(id))
 		return FrameworkReturnCode::_SUCCESS;
-	}
 	else {
 		LOG_DEBUG("Cannot find cloud point with id {} to suppress", id);
 		return FrameworkReturnCode::_ERROR_;
@@ -129,12 +132,10 @@ FrameworkReturnCode SolARPointCloudManager::suppressPoints(const std::vector<uin
 {
 	std::unique_lock<std::mutex> lock(m_mutex);
 	for (auto &it : ids) {
-		std::map< uint32_t, SRef<CloudPoint>>::iterator pointIt = m_pointCloud.find(it);
-		if (pointIt == m_pointCloud.end()) {
+		if (!m_pointCloud.erase(it)) {
 			LOG_DEBUG("Cannot find cloud point with id {} to suppress", it);
 			return FrameworkReturnCode::_ERROR_;
 		}
-		m_pointCloud.erase(pointIt);
 	}
 	return FrameworkReturnCode::_SUCCESS;
 }
@@ -155,10 +156,7 @@ FrameworkReturnCode SolARPointCloudManager::setDescriptorType(const DescriptorTy
 bool SolARPointCloudManager::isExistPoint(const uint32_t id) const
 {
     std::unique_lock<std::mutex> lock(m_mutex);
-	if (m_pointCloud.find(id) != m_pointCloud.end())
-		return true;
-	else 
-		return false;
+	return m_pointCloud.contains(id);
 }
 
 int SolARPointCloudManager::getNbPoints() const
@@ -167,27 +165,116 @@ int SolARPointCloudManager::getNbPoints() const
     return static_cast<int>(m_pointCloud.size());
 }
 
-FrameworkReturnCode SolARPointCloudManager::saveToFile(const std::string& file) const
+SRef<const SolARPointCloudManager::PointCloud> SolARPointCloudManager::getSnapshot() const
+{
+	// only the table of the chunks is copied
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return xpcf::utils::make_shared<PointCloud>(m_pointCloud);
+}
+
+std::function<FrameworkReturnCode(const std::string&)> SolARPointCloudManager::getSnapshotSaver() const
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	uint32_t id = m_id;
+	DescriptorType descriptorType = m_descriptorType;
+	SRef<const PointCloud> pointCloud = xpcf::utils::make_shared<PointCloud>(m_pointCloud);
+	lock.unlock();
+	return [id, descriptorType, pointCloud](const std::string& file) {
+		// the points are serialized in the format of a map of the points by id
+		std::map<uint32_t, SRef<CloudPoint>> points;
+		pointCloud->forEach([&points](const SRef<CloudPoint> &point) { points.emplace_hint(points.end(), point->getId(), point); });
+		std::ofstream ofs(file, std::ios::binary);
+		OutputArchive oa(ofs);
+		oa << id;
+		oa << descriptorType;
+		oa << points;
+		ofs.close();
+		return FrameworkReturnCode::_SUCCESS;
+	};
+}
+
+void SolARPointCloudManager::shareFrom(const SolARPointCloudManager & pointCloudManager)
+{
+	std::unique_lock<std::mutex> lockShared(pointCloudManager.m_mutex);
+	uint32_t id = pointCloudManager.m_id;
+	DescriptorType descriptorType = pointCloudManager.m_descriptorType;
+	PointCloud pointCloud = pointCloudManager.m_pointCloud;
+	lockShared.unlock();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_id = id;
+	m_descriptorType = descriptorType;
+	m_pointCloud = pointCloud;
+}
+
+size_t SolARPointCloudManager::getNbClonedPoints() const
 {
-	std::ofstream ofs(file, std::ios::binary);
-	OutputArchive oa(ofs);
-	oa << m_id;
-	oa << m_descriptorType;
-	oa << m_pointCloud;
-	ofs.close();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	return m_pointCloud.getNbClones();
+}
+
+FrameworkReturnCode SolARPointCloudManager::replacePoint(const SRef<CloudPoint> point)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_pointCloud.contains(point->getId())) {
+		LOG_DEBUG("Cannot find cloud point with id {} to replace", point->getId());
+		return FrameworkReturnCode::_ERROR_;
+	}
+	m_pointCloud.set(point->getId(), point);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARPointCloudManager::renumber(const std::map<uint32_t, uint32_t>& idMap)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	bool isComplete(true);
+	m_pointCloud.forEach([&idMap, &isComplete](const SRef<CloudPoint> &point) {
+		if (isComplete && (idMap.find(point->getId()) == idMap.end())) {
+			LOG_ERROR("Cannot find the new id of the point with id {}", point->getId());
+			isComplete = false;
+		}
+	});
+	if (!isComplete)
+		return FrameworkReturnCode::_ERROR_;
+	// the points shared with a snapshot or another manager are cloned before their ids are modified
+	std::vector<SRef<CloudPoint>> points;
+	m_pointCloud.getAll(points);
+	PointCloud renumbered;
+	uint32_t nextId(0);
+	for (const auto &point : points) {
+		uint32_t id = idMap.at(point->getId());
+		point->setId(id);
+		renumbered.set(id, point);
+		nextId = std::max(nextId, id + 1);
+	}
+	m_pointCloud = renumbered;
+	m_id = nextId;
 	return FrameworkReturnCode::_SUCCESS;
 }
 
+FrameworkReturnCode SolARPointCloudManager::saveToFile(const std::string& file) const
+{
+	return getSnapshotSaver()(file);
+}
+
 FrameworkReturnCode SolARPointCloudManager::loadFromFile(const std::string& file)
 {
 	std::ifstream ifs(file, std::ios::binary);
 	if (!ifs.is_open())
 		return FrameworkReturnCode::_ERROR_;
     InputArchive ia(ifs);
-	ia >> m_id;
-	ia >> m_descriptorType;
-	ia >> m_pointCloud;
+	uint32_t id;
+	DescriptorType descriptorType;
+	std::map<uint32_t, SRef<CloudPoint>> points;
+	ia >> id;
+	ia >> descriptorType;
+	ia >> points;
 	ifs.close();
+	PointCloud pointCloud;
+	pointCloud.assign(points);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_id = id;
+	m_descriptorType = descriptorType;
+	m_pointCloud = pointCloud;
 	return FrameworkReturnCode::_SUCCESS;
 }
 
@@ -15,6 +15,7 @@
  */
 
 #include "SolARSLAMBootstrapper.h"
+#include "SolARMapper.h"
 #include "core/Log.h"
 
 
@@ -118,8 +119,12 @@ FrameworkReturnCode SolARSLAMBootstrapper::process(const SRef<Image> image, SRef
 				m_keyframe2 = xpcf::utils::make_shared<Keyframe>(frame2);
 				keyframesManager->addKeyframe(m_keyframe2);
 				// add intial point cloud to point cloud manager and update visibility map and update covisibility graph
-				for (auto const &it : filteredCloud)
-					m_mapper->addCloudPoint(it);
+				SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+				if (mapper)
+					mapper->addCloudPoints(filteredCloud);
+				else
+					for (auto const &it : filteredCloud)
+						m_mapper->addCloudPoint(it);
 				// add keyframes to retriever
 				keyframeRetriever->addKeyframe(m_keyframe1);
 				keyframeRetriever->addKeyframe(m_keyframe2);
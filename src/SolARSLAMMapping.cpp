@@ -15,13 +15,17 @@
  */
 
 #include "SolARSLAMMapping.h"
+#include "SolARMapper.h"
+#include "SolARDescriptorDistance.h"
 #include "core/Log.h"
+#include <cmath>
+#include <tuple>
+#include <unordered_map>
 
 
 namespace xpcf = org::bcom::xpcf;
 
 XPCF_DEFINE_FACTORY_CREATE_INSTANCE(SolAR::MODULES::TOOLS::SolARSLAMMapping);
-#define MIN_POINT_DISTANCE 0.04
 
 
 namespace SolAR {
@@ -30,7 +34,8 @@ namespace MODULES {
 namespace TOOLS {
 
 
-SolARSLAMMapping::SolARSLAMMapping() :ConfigurableBase(xpcf::toUUID<SolARSLAMMapping>())
+SolARSLAMMapping::SolARSLAMMapping() :ConfigurableBase(xpcf::toUUID<SolARSLAMMapping>()),
+	m_profiler("Mapping", { "total", "keyframeSelection", "localMapCheck", "visibilityUpdate", "culling", "triangulation", "fusion", "insertion" })
 {
 	addInterface<api::slam::IMapping>(this);
 	declareInjectable<api::solver::map::IMapper>(m_mapper);
@@ -49,6 +54,10 @@ SolARSLAMMapping::SolARSLAMMapping() :ConfigurableBase(xpcf::toUUID<SolARSLAMMap
 	declareProperty("minWeightNeighbor", m_minWeightNeighbor);
 	declareProperty("maxNbNeighborKfs", m_maxNbNeighborKfs);
 	declareProperty("minTrackedPoints", m_minTrackedPoints);
+	declareProperty("minPointDistance", m_minPointDistance);
+	declareProperty("maxDescriptorDistance", m_maxDescriptorDistance);
+	declareProperty("enableProfiling", m_enableProfiling);
+	declareProperty("profilingLogPeriod", m_profilingLogPeriod);
 }
 
 void SolARSLAMMapping::setCameraParameters(const CamCalibration & intrinsicParams, const CamDistortion & distortionParams) {
@@ -59,8 +68,27 @@ void SolARSLAMMapping::setCameraParameters(const CamCalibration & intrinsicParam
 }
 
 FrameworkReturnCode SolARSLAMMapping::process(const SRef<Frame> frame, SRef<Keyframe> & keyframe)
+{
+	m_profiler.setEnabled(m_enableProfiling != 0);
+	m_profiler.setLogPeriod(m_profilingLogPeriod);
+	FrameworkReturnCode result;
+	{
+		SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_TOTAL);
+		result = mapKeyframe(frame, keyframe);
+	}
+	m_profiler.endFrame();
+	return result;
+}
+
+void SolARSLAMMapping::getStageStatistics(std::vector<SolARStageProfiler::StageStatistics> &statistics) const
+{
+	m_profiler.getStatistics(statistics);
+}
+
+FrameworkReturnCode SolARSLAMMapping::mapKeyframe(const SRef<Frame> frame, SRef<Keyframe> & keyframe)
 {
 	// find matches between current frame and its reference keyframe
+	SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_KEYFRAME_SELECTION);
 	std::vector<DescriptorMatch> matches;
 	const std::map<uint32_t, uint32_t>& frameVisibilities = frame->getVisibility();
 	const uint32_t& refKf_id = frame->getReferenceKeyframe()->getId();
@@ -76,12 +104,14 @@ FrameworkReturnCode SolARSLAMMapping::process(const SRef<Frame> frame, SRef<Keyf
 	// check need new keyframe
 	if (m_keyframeSelector->select(frame, matches) || (frame->getVisibility().size() < m_minTrackedPoints))
 	{
+		timer.next(STAGE_LOCAL_MAP_CHECK);
 		if (!checkNeedNewKeyframeInLocalMap(frame)) {
 			keyframe = m_updatedReferenceKeyframe;
 			return FrameworkReturnCode::_ERROR_;
 		}
 		else {
 			// create new keyframe
+			timer.stop();
 			keyframe = processNewKeyframe(frame);
 			return FrameworkReturnCode::_SUCCESS;
 		}
@@ -92,6 +122,7 @@ FrameworkReturnCode SolARSLAMMapping::process(const SRef<Frame> frame, SRef<Keyf
 SRef<Keyframe> SolARSLAMMapping::processNewKeyframe(const SRef<Frame>& frame)
 {
 	// create a new keyframe from the current frame
+	SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_VISIBILITY_UPDATE);
 	SRef<Keyframe> newKeyframe = xpcf::utils::make_shared<Keyframe>(frame);
 	// Add to keyframe manager
 	m_keyframesManager->addKeyframe(newKeyframe);
@@ -100,8 +131,10 @@ SRef<Keyframe> SolARSLAMMapping::processNewKeyframe(const SRef<Frame>& frame)
 	// Update keypoint visibility, descriptor in cloud point and connections between new keyframe with other keyframes
 	updateAssociateCloudPoint(newKeyframe);
 	// Map point culling
+	timer.next(STAGE_CULLING);
 	cloudPointsCulling(newKeyframe);
 	// get best neighbor keyframes
+	timer.next(STAGE_TRIANGULATION);
 	std::vector<uint32_t> idxNeighborKfs, idxBestNeighborKfs;
 	m_covisibilityGraph->getNeighbors(newKeyframe->getId(), m_minWeightNeighbor, idxNeighborKfs);
 	if (idxNeighborKfs.size() < m_maxNbNeighborKfs)
@@ -113,9 +146,18 @@ SRef<Keyframe> SolARSLAMMapping::processNewKeyframe(const SRef<Frame>& frame)
 	LOG_DEBUG("Nb of neighbors for mapping: {}", idxBestNeighborKfs.size());
 	findMatchesAndTriangulation(newKeyframe, idxBestNeighborKfs, newCloudPoint);
 	LOG_DEBUG("Nb of new triangulated 3D cloud points: {}", newCloudPoint.size());
+	// merge the new points close to existing ones
+	timer.next(STAGE_FUSION);
+	if (m_minPointDistance > 0.f)
+		fuseCloudPoint(newKeyframe, idxBestNeighborKfs, newCloudPoint);
 	// add new points to point cloud manager, update visibility map and covisibility graph
+	timer.next(STAGE_INSERTION);
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	if (mapper)
+		mapper->addCloudPoints(newCloudPoint);
 	for (auto const &point : newCloudPoint) {
-		m_mapper->addCloudPoint(point);
+		if (!mapper)
+			m_mapper->addCloudPoint(point);
 		m_recentAddedCloudPoints[point->getId()] = std::make_pair(point, newKeyframe->getId());
 	}
 	return newKeyframe;
@@ -133,7 +175,11 @@ bool SolARSLAMMapping::checkNeedNewKeyframeInLocalMap(const SRef<Frame>& frame)
 	if (m_keyframeRetriever->retrieve(frame, candidates, ret_keyframesId) == FrameworkReturnCode::_SUCCESS) {
 		if (ret_keyframesId[0] != referenceKeyframe->getId()) {
 			SRef<Keyframe> bestRetKeyframe;
-			m_keyframesManager->getKeyframe(ret_keyframesId[0], bestRetKeyframe);
+			// the retriever can return a keyframe evicted from the map
+			if (m_keyframesManager->getKeyframe(ret_keyframesId[0], bestRetKeyframe) != FrameworkReturnCode::_SUCCESS) {
+				LOG_DEBUG("Need to make new keyframe");
+				return true;
+			}
 			// Check find enough matches to best ret keyframe
 			std::vector<DescriptorMatch> matches;
 			m_matcher->match(bestRetKeyframe->getDescriptors(), frame->getDescriptors(), matches);
@@ -245,11 +291,125 @@ void SolARSLAMMapping::findMatchesAndTriangulation(const SRef<Keyframe>& keyfram
 	}
 }
 
+void SolARSLAMMapping::fuseCloudPoint(const SRef<Keyframe>& keyframe, const std::vector<uint32_t>& idxNeigborKfs, std::vector<SRef<CloudPoint>>& newCloudPoint)
+{
+	// voxel hash of the local point cloud and of the new points kept so far, the voxel size is the minimum distance between points
+	const float voxelSize = m_minPointDistance;
+	auto voxelKey = [](int64_t x, int64_t y, int64_t z) {
+		return ((x & 0x1FFFFF) << 42) | ((y & 0x1FFFFF) << 21) | (z & 0x1FFFFF);
+	};
+	auto voxelCoordinates = [voxelSize](const SRef<CloudPoint> &point) {
+		return std::make_tuple(static_cast<int64_t>(std::floor(point->getX() / voxelSize)), static_cast<int64_t>(std::floor(point->getY() / voxelSize)),
+							   static_cast<int64_t>(std::floor(point->getZ() / voxelSize)));
+	};
+	std::unordered_map<int64_t, std::vector<std::pair<SRef<CloudPoint>, bool>>> voxels;
+	auto addToVoxels = [&](const SRef<CloudPoint> &point, bool isNew) {
+		auto v = voxelCoordinates(point);
+		voxels[voxelKey(std::get<0>(v), std::get<1>(v), std::get<2>(v))].push_back(std::make_pair(point, isNew));
+	};
+	std::vector<SRef<CloudPoint>> localPointCloud;
+	m_mapper->getLocalPointCloud(keyframe, m_minWeightNeighbor, localPointCloud);
+	for (const auto &it : localPointCloud)
+		addToVoxels(it, false);
+
+	// the observations merged into points of the map are added by a single transaction when the mapper supports it,
+	// else directly to the keyframes observing the new points
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	SolARMapper::Transaction transaction;
+	std::map<uint32_t, SRef<Keyframe>> keyframes;
+	if (!mapper) {
+		keyframes[keyframe->getId()] = keyframe;
+		for (const auto &it : idxNeigborKfs) {
+			SRef<Keyframe> neighbor;
+			if (m_keyframesManager->getKeyframe(it, neighbor) == FrameworkReturnCode::_SUCCESS)
+				keyframes[it] = neighbor;
+		}
+	}
+
+	std::vector<SRef<CloudPoint>> keptCloudPoint;
+	int nbMerged(0);
+	for (const auto &point : newCloudPoint) {
+		const std::map<uint32_t, uint32_t> &pointVisibility = point->getVisibility();
+		// find the closest compatible point: close enough, with a similar descriptor and not already observed by the same keyframes
+		auto v = voxelCoordinates(point);
+		SRef<CloudPoint> closestPoint;
+		bool isClosestNew(false);
+		float minDistance = m_minPointDistance;
+		for (int64_t dx = -1; dx <= 1; ++dx)
+			for (int64_t dy = -1; dy <= 1; ++dy)
+				for (int64_t dz = -1; dz <= 1; ++dz) {
+					auto itVoxel = voxels.find(voxelKey(std::get<0>(v) + dx, std::get<1>(v) + dy, std::get<2>(v) + dz));
+					if (itVoxel == voxels.end())
+						continue;
+					for (const auto &candidate : itVoxel->second) {
+						float distance = (candidate.first->getX() - point->getX()) * (candidate.first->getX() - point->getX()) +
+							(candidate.first->getY() - point->getY()) * (candidate.first->getY() - point->getY()) +
+							(candidate.first->getZ() - point->getZ()) * (candidate.first->getZ() - point->getZ());
+						distance = std::sqrt(distance);
+						if (distance >= minDistance)
+							continue;
+						const std::map<uint32_t, uint32_t> &candidateVisibility = candidate.first->getVisibility();
+						bool isObservedBySameKeyframe(false);
+						for (const auto &vis : pointVisibility)
+							if (candidateVisibility.find(vis.first) != candidateVisibility.end()) {
+								isObservedBySameKeyframe = true;
+								break;
+							}
+						if (isObservedBySameKeyframe || !candidate.first->getDescriptor() || !point->getDescriptor() ||
+							(descriptorDistance(candidate.first->getDescriptor(), 0, point->getDescriptor(), 0, true) > m_maxDescriptorDistance))
+							continue;
+						minDistance = distance;
+						closestPoint = candidate.first;
+						isClosestNew = candidate.second;
+					}
+				}
+		if (!closestPoint) {
+			keptCloudPoint.push_back(point);
+			addToVoxels(point, true);
+			continue;
+		}
+		// merge the observations of the new point as extra observations of the closest point
+		nbMerged++;
+		if (isClosestNew) {
+			// the closest point is not in the map yet, the mapper updates the keyframes when it is added
+			for (const auto &vis : pointVisibility)
+				closestPoint->addVisibility(vis.first, vis.second);
+			continue;
+		}
+		if (mapper) {
+			for (const auto &vis : pointVisibility)
+				transaction.addObservation(closestPoint, vis.first, vis.second);
+			continue;
+		}
+		std::vector<uint32_t> observingKeyframeIds;
+		for (const auto &vis : closestPoint->getVisibility())
+			observingKeyframeIds.push_back(vis.first);
+		for (const auto &vis : pointVisibility) {
+			auto itKeyframe = keyframes.find(vis.first);
+			if (itKeyframe == keyframes.end())
+				continue;
+			closestPoint->addVisibility(vis.first, vis.second);
+			itKeyframe->second->addVisibility(vis.second, closestPoint->getId());
+			for (const auto &it : observingKeyframeIds)
+				m_covisibilityGraph->increaseEdge(vis.first, it, 1);
+			observingKeyframeIds.push_back(vis.first);
+		}
+	}
+	if (mapper && (transaction.size() > 0))
+		mapper->commit(transaction);
+	newCloudPoint.swap(keptCloudPoint);
+	m_nbMergedCloudPoints += nbMerged;
+	LOG_DEBUG("Nb of merged cloud points: {} (total: {})", nbMerged, m_nbMergedCloudPoints);
+}
+
 void SolARSLAMMapping::cloudPointsCulling(const SRef<Keyframe>& keyframe)
 {
 	const uint32_t& currentKfId = keyframe->getId();
 	int nbRemove(0);
 	std::vector<uint32_t> toRemove;
+	// the culled points are removed by a single transaction when the mapper supports it
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	SolARMapper::Transaction transaction;
 	for (const auto &it : m_recentAddedCloudPoints) {		
 		const SRef<CloudPoint>& cp = it.second.first;
 		const uint32_t& cpIdKf = it.second.second;
@@ -259,13 +419,18 @@ void SolARSLAMMapping::cloudPointsCulling(const SRef<Keyframe>& keyframe)
 		}
 		if (((currentKfId - cpIdKf) >= 2) && (cp->getVisibility().size() < 3)) {
 			//std::cout << "Erase point: " << it.first << " " << cp->getId() << std::endl;
-			m_mapper->removeCloudPoint(cp);
+			if (mapper)
+				transaction.removeCloudPoint(cp);
+			else
+				m_mapper->removeCloudPoint(cp);
 			toRemove.push_back(it.first);
 			nbRemove++;
 		}
 		else if ((currentKfId - cpIdKf) > 2)
 			toRemove.push_back(it.first);
 	}
+	if (mapper)
+		mapper->commit(transaction);
 	for (const auto& it : toRemove)
 		m_recentAddedCloudPoints.erase(it);
 	
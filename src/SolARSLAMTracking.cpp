@@ -15,7 +15,21 @@
  */
 
 #include "SolARSLAMTracking.h"
+#include "SolARMapper.h"
+#include "SolARDescriptorDistance.h"
 #include "core/Log.h"
+#include <cstring>
+
+// minimum number of inlier matches to accept a pose tracked with the motion model
+#define MOTION_MODEL_MIN_INLIERS 30
+// margin of the in-image test of the local map culling relative to the image size, the distortion is only applied by the projector
+#define LOCAL_MAP_IMAGE_MARGIN 0.1f
+// id of the session used by the methods of the ITracking interface
+#define DEFAULT_SESSION 0
+// fractions of the latency budget elapsed from which the number of local map candidates is capped, the search radius is shrunk and the pose refinement is skipped
+#define DEADLINE_CAP_CANDIDATES_RATIO 0.5f
+#define DEADLINE_SHRINK_RADIUS_RATIO 0.65f
+#define DEADLINE_SKIP_REFINEMENT_RATIO 0.8f
 
 
 namespace xpcf = org::bcom::xpcf;
@@ -29,7 +43,9 @@ namespace MODULES {
 namespace TOOLS {
 
 
-SolARSLAMTracking::SolARSLAMTracking() :ConfigurableBase(xpcf::toUUID<SolARSLAMTracking>())
+SolARSLAMTracking::SolARSLAMTracking() :ConfigurableBase(xpcf::toUUID<SolARSLAMTracking>()),
+	m_profiler("Tracking", { "total", "relocalization", "localMapUpdate", "match", "filter", "correspondences", "pnpRansac",
+							 "localMapCulling", "projection", "regionMatching", "refinement" })
 {
 	addInterface<api::slam::ITracking>(this);
 	declareInjectable<api::solver::map::IMapper>(m_mapper);
@@ -45,6 +61,33 @@ SolARSLAMTracking::SolARSLAMTracking() :ConfigurableBase(xpcf::toUUID<SolARSLAMT
 	declareProperty("minWeightNeighbor", m_minWeightNeighbor);
 	declareProperty("thresAngleViewDirection", m_thresAngleViewDirection);
 	declareProperty("displayTrackedPoints", m_displayTrackedPoints);
+	declareProperty("keypointGridCellSize", m_keypointGridCellSize);
+	declareProperty("searchRadius", m_searchRadius);
+	declareProperty("useMotionModel", m_useMotionModel);
+	declareProperty("motionModelSearchRadius", m_motionModelSearchRadius);
+	declareProperty("displayMode", m_displayMode);
+	declareProperty("asyncRelocalization", m_asyncRelocalization);
+	declareProperty("enableProfiling", m_enableProfiling);
+	declareProperty("profilingLogPeriod", m_profilingLogPeriod);
+	declareProperty("latencyBudget", m_latencyBudget);
+	declareProperty("degradedMaxCandidates", m_degradedMaxCandidates);
+	declareProperty("degradedSearchRadiusRatio", m_degradedSearchRadiusRatio);
+	// the session of the ITracking interface uses the injected components
+	m_sessions[DEFAULT_SESSION] = xpcf::utils::make_shared<Session>();
+	m_sessions[DEFAULT_SESSION]->id = DEFAULT_SESSION;
+}
+
+SolARSLAMTracking::~SolARSLAMTracking()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_relocMutex);
+		m_isRelocRunning = false;
+		m_relocFrames.clear();
+		m_relocOrder.clear();
+	}
+	m_relocCondition.notify_all();
+	if (m_relocThread.joinable())
+		m_relocThread.join();
 }
 
 void SolARSLAMTracking::setCameraParameters(const CamCalibration & intrinsicParams, const CamDistortion & distortionParams) {
@@ -53,53 +96,243 @@ void SolARSLAMTracking::setCameraParameters(const CamCalibration & intrinsicPara
 	m_pnpRansac->setCameraParameters(m_camMatrix, m_camDistortion);
 	m_pnp->setCameraParameters(m_camMatrix, m_camDistortion);
 	m_projector->setCameraParameters(m_camMatrix, m_camDistortion);
+	// the components of the sessions which are not shared
+	std::unique_lock<std::mutex> lock(m_sessionsMutex);
+	for (const auto &it : m_sessions)
+		setSessionCameraParameters(it.second->components);
+	m_isCameraParametersSet = true;
 }
 
 void SolARSLAMTracking::updateReferenceKeyframe(const SRef<Keyframe> refKeyframe)
 {
-	std::unique_lock<std::mutex> lock(m_refKeyframeMutex);
-	m_referenceKeyframe = refKeyframe;	
-	m_isUpdateReferenceKeyframe = true;
+	updateReferenceKeyframe(DEFAULT_SESSION, refKeyframe);
 }
 
 FrameworkReturnCode SolARSLAMTracking::process(const SRef<Frame> frame, SRef<Image> &displayImage)
+{
+	return process(DEFAULT_SESSION, frame, displayImage);
+}
+
+FrameworkReturnCode SolARSLAMTracking::createSession(uint32_t &sessionId, const SessionComponents &components)
+{
+	SRef<Session> session = xpcf::utils::make_shared<Session>();
+	// a new session has no reference keyframe, it is relocalized until one is found or set
+	session->isLostTrack = true;
+	session->components = components;
+	bindSessionComponents(session->components);
+	if (m_isCameraParametersSet)
+		setSessionCameraParameters(session->components);
+	std::unique_lock<std::mutex> lock(m_sessionsMutex);
+	session->id = m_nextSessionId++;
+	m_sessions[session->id] = session;
+	sessionId = session->id;
+	LOG_DEBUG("Create tracking session {}", sessionId);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARSLAMTracking::destroySession(const uint32_t sessionId)
+{
+	if (sessionId == DEFAULT_SESSION)
+		return FrameworkReturnCode::_ERROR_;
+	std::unique_lock<std::mutex> lock(m_sessionsMutex);
+	auto it = m_sessions.find(sessionId);
+	if (it == m_sessions.end())
+		return FrameworkReturnCode::_ERROR_;
+	SRef<Session> session = it->second;
+	m_sessions.erase(it);
+	lock.unlock();
+	// the reference keyframe of the session is not protected from the eviction anymore
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	std::unique_lock<std::mutex> refKeyframeLock(session->refKeyframeMutex);
+	if (mapper && session->referenceKeyframe)
+		mapper->unpinKeyframe(session->referenceKeyframe->getId());
+	if (mapper && session->pendingReferenceKeyframe)
+		mapper->unpinKeyframe(session->pendingReferenceKeyframe->getId());
+	LOG_DEBUG("Destroy tracking session {}", sessionId);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+FrameworkReturnCode SolARSLAMTracking::updateReferenceKeyframe(const uint32_t sessionId, const SRef<Keyframe> refKeyframe)
+{
+	SRef<Session> session = getSession(sessionId);
+	if (!session)
+		return FrameworkReturnCode::_ERROR_;
+	// the keyframe can be set from another thread, such as the relocalization thread, it is applied by the next tracked frame
+	std::unique_lock<std::mutex> lock(session->refKeyframeMutex);
+	// the reference keyframe of each session is protected from the eviction of the mapper
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	if (mapper) {
+		mapper->pinKeyframe(refKeyframe->getId());
+		if (session->pendingReferenceKeyframe)
+			mapper->unpinKeyframe(session->pendingReferenceKeyframe->getId());
+	}
+	session->pendingReferenceKeyframe = refKeyframe;
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+void SolARSLAMTracking::applyPendingReferenceKeyframe(Session &session)
+{
+	std::unique_lock<std::mutex> lock(session.refKeyframeMutex);
+	if (!session.pendingReferenceKeyframe)
+		return;
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	if (mapper && session.referenceKeyframe)
+		mapper->unpinKeyframe(session.referenceKeyframe->getId());
+	session.referenceKeyframe = session.pendingReferenceKeyframe;
+	session.pendingReferenceKeyframe = nullptr;
+	session.isUpdateReferenceKeyframe = true;
+}
+
+FrameworkReturnCode SolARSLAMTracking::process(const uint32_t sessionId, const SRef<Frame> frame, SRef<Image> &displayImage)
+{
+	SRef<Session> session = getSession(sessionId);
+	if (!session)
+		return FrameworkReturnCode::_ERROR_;
+	// a session tracks one frame at a time, the sessions using shared components are serialized
+	std::unique_lock<std::mutex> sessionLock(session->processMutex);
+	bool isUsingSharedComponents = bindSessionComponents(session->components);
+	std::unique_lock<std::mutex> sharedLock(m_sharedComponentsMutex, std::defer_lock);
+	if (isUsingSharedComponents)
+		sharedLock.lock();
+	m_profiler.setEnabled(m_enableProfiling != 0);
+	m_profiler.setLogPeriod(m_profilingLogPeriod);
+	session->frameStart = std::chrono::steady_clock::now();
+	session->degradations = DEGRADATION_NONE;
+	FrameworkReturnCode result;
+	{
+		SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_TOTAL);
+		result = track(*session, frame, displayImage);
+	}
+	m_profiler.endFrame();
+	if (session->degradations != DEGRADATION_NONE)
+		LOG_DEBUG("Degradations of the frame of session {} to meet the latency budget: {}{}{}", sessionId,
+			session->degradations & DEGRADATION_CAP_CANDIDATES ? "capped candidates " : "",
+			session->degradations & DEGRADATION_SHRINK_RADIUS ? "shrunk radius " : "",
+			session->degradations & DEGRADATION_SKIP_REFINEMENT ? "skipped refinement" : "");
+	return result;
+}
+
+uint32_t SolARSLAMTracking::getFrameDegradations(const uint32_t sessionId)
+{
+	SRef<Session> session = getSession(sessionId);
+	if (!session)
+		return DEGRADATION_NONE;
+	std::unique_lock<std::mutex> lock(session->processMutex);
+	return session->degradations;
+}
+
+bool SolARSLAMTracking::applyDegradation(Session &session, const Degradation degradation)
+{
+	// a degradation applied once is kept until the end of the frame
+	if (session.degradations & degradation)
+		return true;
+	if (m_latencyBudget <= 0.f)
+		return false;
+	float ratio = DEADLINE_SKIP_REFINEMENT_RATIO;
+	if (degradation == DEGRADATION_CAP_CANDIDATES)
+		ratio = DEADLINE_CAP_CANDIDATES_RATIO;
+	else if (degradation == DEGRADATION_SHRINK_RADIUS)
+		ratio = DEADLINE_SHRINK_RADIUS_RATIO;
+	float elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - session.frameStart).count();
+	if (elapsed < ratio * m_latencyBudget)
+		return false;
+	session.degradations |= degradation;
+	return true;
+}
+
+SRef<SolARSLAMTracking::Session> SolARSLAMTracking::getSession(const uint32_t sessionId)
+{
+	std::unique_lock<std::mutex> lock(m_sessionsMutex);
+	auto it = m_sessions.find(sessionId);
+	return it != m_sessions.end() ? it->second : nullptr;
+}
+
+bool SolARSLAMTracking::bindSessionComponents(SessionComponents &components)
+{
+	bool isUsingSharedComponents = false;
+	auto bind = [&isUsingSharedComponents](auto &component, const auto &injected) {
+		if (!component)
+			component = injected;
+		if (component == injected)
+			isUsingSharedComponents = true;
+	};
+	bind(components.matcher, m_matcher);
+	bind(components.matchesFilter, m_matchesFilter);
+	bind(components.corr2D3DFinder, m_corr2D3DFinder);
+	bind(components.pnpRansac, m_pnpRansac);
+	bind(components.pnp, m_pnp);
+	bind(components.projector, m_projector);
+	bind(components.overlay2D, m_overlay2D);
+	return isUsingSharedComponents;
+}
+
+void SolARSLAMTracking::setSessionCameraParameters(const SessionComponents &components)
+{
+	if (components.pnpRansac && (components.pnpRansac != m_pnpRansac))
+		components.pnpRansac->setCameraParameters(m_camMatrix, m_camDistortion);
+	if (components.pnp && (components.pnp != m_pnp))
+		components.pnp->setCameraParameters(m_camMatrix, m_camDistortion);
+	if (components.projector && (components.projector != m_projector))
+		components.projector->setCameraParameters(m_camMatrix, m_camDistortion);
+}
+
+void SolARSLAMTracking::getStageStatistics(std::vector<SolARStageProfiler::StageStatistics> &statistics) const
+{
+	m_profiler.getStatistics(statistics);
+}
+
+FrameworkReturnCode SolARSLAMTracking::track(Session &session, const SRef<Frame> frame, SRef<Image> &displayImage)
 {
 	// init image to display
-	displayImage = frame->getView()->copy();
+	initDisplayImage(session, frame, displayImage);
 	std::vector<DescriptorMatch> matches;
 	Transform3Df framePose;
-	if (m_isLostTrack) {
+	if (session.isLostTrack) {
 		LOG_DEBUG("Pose estimation has failed");		
+		// the motion and the matching distance are unknown until the session is tracked again
+		session.isMotionValid = false;
+		session.hasLastTrackedPose = false;
+		session.lastMaxMatchDistance = 0.f;
 		// reloc
-		std::vector < uint32_t> retKeyframesId;
-		if (m_keyframeRetriever->retrieve(frame, retKeyframesId) == FrameworkReturnCode::_SUCCESS) {
-			LOG_DEBUG("Successful relocalization. Update reference keyframe id: {}", retKeyframesId[0]);
-			SRef<Keyframe> bestRetKeyframe;
-			m_keyframesManager->getKeyframe(retKeyframesId[0], bestRetKeyframe);
-			updateReferenceKeyframe(bestRetKeyframe);
-		}
+		SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_RELOCALIZATION);
+		if (m_asyncRelocalization)
+			postRelocalization(session.id, frame);
 		else
-			LOG_DEBUG("Relocalization Failed");
+			relocalize(session, frame);
+	}
+	// the reference keyframe found by the relocalization or set by another component is only changed by the tracking of the session
+	applyPendingReferenceKeyframe(session);
+	if (!session.referenceKeyframe) {
+		LOG_DEBUG("No reference keyframe to track the frame of session {}", session.id);
+		session.isLostTrack = true;
+		return FrameworkReturnCode::_ERROR_;
 	}
 	// update local map
-	if (m_isUpdateReferenceKeyframe) {
-		updateLocalMap();
+	if (session.isUpdateReferenceKeyframe) {
+		SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_LOCAL_MAP_UPDATE);
+		updateLocalMap(session);
 	}
 
 	// set reference keyframe for new frame
-	frame->setReferenceKeyframe(m_referenceKeyframe);	
+	frame->setReferenceKeyframe(session.referenceKeyframe);	
+	// guided matching of the local map projected with the predicted pose, the reference keyframe is matched only if it fails
+	if (m_useMotionModel && session.isMotionValid && (trackWithMotionModel(session, frame, displayImage) == FrameworkReturnCode::_SUCCESS))
+		return FrameworkReturnCode::_SUCCESS;
 	// matching feature
-	m_isLostTrack = true;
-	m_matcher->match(m_referenceKeyframe->getDescriptors(), frame->getDescriptors(), matches);
+	session.isLostTrack = true;
+	SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_MATCH);
+	session.components.matcher->match(session.referenceKeyframe->getDescriptors(), frame->getDescriptors(), matches);
 	if (matches.size() < 10)
 		return FrameworkReturnCode::_ERROR_;
-	m_matchesFilter->filter(matches, matches, m_referenceKeyframe->getKeypoints(), frame->getKeypoints());
-	float maxMatchDistance = -FLT_MAX;
+	timer.next(STAGE_FILTER);
+	session.components.matchesFilter->filter(matches, matches, session.referenceKeyframe->getKeypoints(), frame->getKeypoints());
+	float maxMatchDistance = matches.empty() ? 0.f : -FLT_MAX;
 	for (const auto &it : matches) {
 		float score = it.getMatchingScore();
 		if (score > maxMatchDistance)
 			maxMatchDistance = score;
 	}
+	session.lastMaxMatchDistance = maxMatchDistance;
 	// find 2D-3D point correspondences
 	std::vector<Point2Df> pt2d;
 	std::vector<Point3Df> pt3d;
@@ -107,20 +340,15 @@ FrameworkReturnCode SolARSLAMTracking::process(const SRef<Frame> frame, SRef<Ima
 	std::vector<DescriptorMatch> foundMatches;
 	std::vector<DescriptorMatch> remainingMatches;
 	std::vector < std::pair<uint32_t, SRef<CloudPoint>>> corres2D3D;
-	m_corr2D3DFinder->find(m_referenceKeyframe, frame, matches, pt3d, pt2d, corres2D3D, foundMatches, remainingMatches);
+	timer.next(STAGE_CORRESPONDENCES);
+	session.components.corr2D3DFinder->find(session.referenceKeyframe, frame, matches, pt3d, pt2d, corres2D3D, foundMatches, remainingMatches);
 	LOG_DEBUG("Nb of 2D-3D correspondences: {}", pt2d.size());	
 
-	// get cosine view direction angle 
-	auto cosineViewDirectionAngle = [](const SRef<Frame>& frame, const SRef<CloudPoint>& cp) {
-		const Transform3Df &pose = frame->getPose();
-		Vector3f frameViewDir(pose(0, 3) - cp->getX(), pose(1, 3) - cp->getY(), pose(2, 3) - cp->getZ());
-		const Vector3f& cpViewDir = cp->getViewDirection();
-		return cpViewDir.dot(frameViewDir.normalized());
-	};
-
 	// run pnp ransac
 	std::vector<uint32_t> inliers;
-	if (m_pnpRansac->estimate(pt2d, pt3d, inliers, framePose, m_lastPose) == FrameworkReturnCode::_SUCCESS) {
+	timer.next(STAGE_PNP_RANSAC);
+	if (session.components.pnpRansac->estimate(pt2d, pt3d, inliers, framePose, session.lastPose) == FrameworkReturnCode::_SUCCESS) {
+		timer.stop();
 		LOG_DEBUG("Inliers / Nb of correspondences: {} / {}", inliers.size(), pt3d.size());
 		LOG_DEBUG("Estimated pose: \n {}", framePose.matrix());
 		// Set the pose of the new frame
@@ -133,52 +361,36 @@ FrameworkReturnCode SolARSLAMTracking::process(const SRef<Frame> frame, SRef<Ima
 		// find visibilities from inliers and update confidence score of cloud points
 		int itInliers = 0;
 		inliers.push_back(-1);
-		std::set<uint32_t> idxCPSeen;
+		std::vector<uint32_t> idxCPSeen;
+		std::vector<SRef<CloudPoint>> matchedPoints;
+		std::vector<bool> isInliers;
 		for (int itCorr = 0; itCorr < corres2D3D.size(); ++itCorr) {
 			std::pair<uint32_t, SRef<CloudPoint>> corr2D3D = corres2D3D[itCorr];
-			idxCPSeen.insert(corr2D3D.second->getId());
+			idxCPSeen.push_back(corr2D3D.second->getId());
 			if (itCorr == inliers[itInliers]) { // Inliers
 				newMapVisibility[corr2D3D.first] = corr2D3D.second->getId();
-				corr2D3D.second->updateConfidence(true);
+				matchedPoints.push_back(corr2D3D.second);
+				isInliers.push_back(true);
 				pts2dInliers.push_back(Point2Df(keypoints[corr2D3D.first].getX(), keypoints[corr2D3D.first].getY()));
 				pts3dInliers.push_back(Point3Df(corr2D3D.second->getX(), corr2D3D.second->getY(), corr2D3D.second->getZ()));
 				itInliers++;
 			}
 			else { // Outliers
-				corr2D3D.second->updateConfidence(false);
+				matchedPoints.push_back(corr2D3D.second);
+				isInliers.push_back(false);
 			}
 		}
 
 		// find other visiblities from local map
-		std::vector<SRef<CloudPoint>> localMapUnseen;
-		for (auto &it_cp : m_localMap)
-			if ((idxCPSeen.find(it_cp->getId()) == idxCPSeen.end()) && (cosineViewDirectionAngle(frame, it_cp) > m_thresAngleViewDirection))	
-				localMapUnseen.push_back(it_cp);		
-
 		std::vector<SRef<CloudPoint>> localMapUnseenCandidates;
 		std::vector< Point2Df > projected2DPtsCandidates;
-		//  projection points and filter point out of frame
-		if (localMapUnseen.size() > 0) {
-			std::vector< Point2Df > projected2DPts;
-			m_projector->project(localMapUnseen, projected2DPts, frame->getPose());
-			uint32_t imgWidth = frame->getView()->getWidth();
-			uint32_t imgHeight = frame->getView()->getHeight();
-			for (int idx = 0; idx < projected2DPts.size(); idx++)
-				if ((projected2DPts[idx].getX() > 0) && (projected2DPts[idx].getX() < imgWidth) && (projected2DPts[idx].getY() > 0) && (projected2DPts[idx].getY() < imgHeight)) {
-					projected2DPtsCandidates.push_back(std::move(projected2DPts[idx]));
-					localMapUnseenCandidates.push_back(std::move(localMapUnseen[idx]));
-				}
-		}
+		findLocalMapCandidates(session, frame, idxCPSeen, localMapUnseenCandidates, projected2DPtsCandidates);
 		LOG_DEBUG("Nb of filtered local map : {}", localMapUnseenCandidates.size());
 
 		if (localMapUnseenCandidates.size() > 0) {
 			// find more inlier matches
-			std::vector<SRef<DescriptorBuffer>> desAllLocalMapUnseen;
-			for (auto &it_cp : localMapUnseenCandidates) {
-				desAllLocalMapUnseen.push_back(it_cp->getDescriptor());
-			}
 			std::vector<DescriptorMatch> allMatches;
-			m_matcher->matchInRegion(projected2DPtsCandidates, desAllLocalMapUnseen, frame, allMatches, 0, maxMatchDistance);
+			matchLocalMap(session, localMapUnseenCandidates, projected2DPtsCandidates, frame, 0.f, maxMatchDistance, allMatches);
 			// find visibility of new frame
 			int nbMatchesLocalMap(0);
 			std::vector<bool> checkLocalMapInOut(localMapUnseenCandidates.size(), false);
@@ -196,42 +408,465 @@ FrameworkReturnCode SolARSLAMTracking::process(const SRef<Frame> frame, SRef<Ima
 			LOG_DEBUG("Nb of matched local map: {}", nbMatchesLocalMap);
 			// update confidence score of matched cloud points
 			for (int i = 0; i < localMapUnseenCandidates.size(); ++i) {
-				if (checkLocalMapInOut[i])
-					localMapUnseenCandidates[i]->updateConfidence(true);
+				if (checkLocalMapInOut[i]) {
+					matchedPoints.push_back(localMapUnseenCandidates[i]);
+					isInliers.push_back(true);
+				}
 			}
 		}
+		updateConfidences(matchedPoints, isInliers);
 
-		// pnp optimization
-		Transform3Df refinedPose;
-		m_pnp->estimate(pts2dInliers, pts3dInliers, refinedPose, frame->getPose());
-		frame->setPose(refinedPose);
+		// pnp optimization, the pose of pnp ransac is kept if the latency budget is nearly spent
+		if (!applyDegradation(session, DEGRADATION_SKIP_REFINEMENT)) {
+			SolARStageProfiler::ScopedTimer refinementTimer(m_profiler, STAGE_REFINEMENT);
+			Transform3Df refinedPose;
+			session.components.pnp->estimate(pts2dInliers, pts3dInliers, refinedPose, frame->getPose());
+			frame->setPose(refinedPose);
+		}
 		// update map visibility of current frame
 		frame->addVisibilities(newMapVisibility);
 		LOG_DEBUG("Nb of map visibilities of current frame: {}", newMapVisibility.size());
 
 		// display tracked points
-		if (m_displayTrackedPoints)
-			m_overlay2D->drawCircles(pts2dInliers, displayImage);
+		if (m_displayTrackedPoints && (m_displayMode != DISPLAY_HEADLESS))
+			session.components.overlay2D->drawCircles(pts2dInliers, displayImage);
 
 		LOG_DEBUG("Refined pose: \n {}", frame->getPose().matrix());
-		m_lastPose = frame->getPose();
+		session.lastPose = frame->getPose();
+		updateMotionModel(session, frame->getPose());
 
 		// tracking is good
-		m_isLostTrack = false;	
+		session.isLostTrack = false;	
 		return FrameworkReturnCode::_SUCCESS;
 	}
 	
 	return FrameworkReturnCode::_ERROR_;		
 }
 
-void SolARSLAMTracking::updateLocalMap()
+FrameworkReturnCode SolARSLAMTracking::trackWithMotionModel(Session &session, const SRef<Frame> frame, SRef<Image> &displayImage)
+{
+	// the guided matching is bounded by the distance of the last matching with the reference keyframe
+	if (session.lastMaxMatchDistance <= 0.f)
+		return FrameworkReturnCode::_ERROR_;
+	// constant velocity: the motion between the last two tracked frames is applied to the last tracked pose
+	Transform3Df predictedPose = session.lastTrackedPose * session.motion;
+	frame->setPose(predictedPose);
+	std::vector<SRef<CloudPoint>> localMapCandidates;
+	std::vector<Point2Df> projected2DPtsCandidates;
+	findLocalMapCandidates(session, frame, std::vector<uint32_t>(), localMapCandidates, projected2DPtsCandidates);
+	if (localMapCandidates.size() < MOTION_MODEL_MIN_INLIERS)
+		return FrameworkReturnCode::_ERROR_;
+	std::vector<DescriptorMatch> matches;
+	matchLocalMap(session, localMapCandidates, projected2DPtsCandidates, frame, m_motionModelSearchRadius, session.lastMaxMatchDistance, matches);
+	LOG_DEBUG("Nb of local map matches with the motion model: {}", matches.size());
+	if (matches.size() < MOTION_MODEL_MIN_INLIERS)
+		return FrameworkReturnCode::_ERROR_;
+	const std::vector<Keypoint> &keypoints = frame->getKeypoints();
+	std::vector<Point2Df> pt2d;
+	std::vector<Point3Df> pt3d;
+	for (const auto &it_match : matches) {
+		const Keypoint &kp = keypoints[it_match.getIndexInDescriptorB()];
+		const SRef<CloudPoint> &cp = localMapCandidates[it_match.getIndexInDescriptorA()];
+		pt2d.push_back(Point2Df(kp.getX(), kp.getY()));
+		pt3d.push_back(Point3Df(cp->getX(), cp->getY(), cp->getZ()));
+	}
+	std::vector<uint32_t> inliers;
+	Transform3Df framePose;
+	SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_PNP_RANSAC);
+	if ((session.components.pnpRansac->estimate(pt2d, pt3d, inliers, framePose, predictedPose) != FrameworkReturnCode::_SUCCESS) ||
+		(inliers.size() < MOTION_MODEL_MIN_INLIERS)) {
+		LOG_DEBUG("Tracking with the motion model has failed");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	timer.stop();
+	// update map visibility of frame and confidence score of cloud points
+	std::map<uint32_t, uint32_t> newMapVisibility;
+	std::vector<Point2Df> pts2dInliers;
+	std::vector<Point3Df> pts3dInliers;
+	std::vector<bool> isInlier(matches.size(), false);
+	std::vector<SRef<CloudPoint>> matchedPoints;
+	for (const auto &it : inliers)
+		isInlier[it] = true;
+	for (int i = 0; i < matches.size(); ++i) {
+		const SRef<CloudPoint> &cp = localMapCandidates[matches[i].getIndexInDescriptorA()];
+		matchedPoints.push_back(cp);
+		if (isInlier[i]) {
+			newMapVisibility[matches[i].getIndexInDescriptorB()] = cp->getId();
+			pts2dInliers.push_back(pt2d[i]);
+			pts3dInliers.push_back(pt3d[i]);
+		}
+	}
+	updateConfidences(matchedPoints, isInlier);
+	// pnp optimization, the pose of pnp ransac is kept if the latency budget is nearly spent
+	if (applyDegradation(session, DEGRADATION_SKIP_REFINEMENT))
+		frame->setPose(framePose);
+	else {
+		SolARStageProfiler::ScopedTimer refinementTimer(m_profiler, STAGE_REFINEMENT);
+		Transform3Df refinedPose;
+		session.components.pnp->estimate(pts2dInliers, pts3dInliers, refinedPose, framePose);
+		frame->setPose(refinedPose);
+	}
+	frame->addVisibilities(newMapVisibility);
+	LOG_DEBUG("Nb of map visibilities of current frame with the motion model: {}", newMapVisibility.size());
+
+	// display tracked points
+	if (m_displayTrackedPoints && (m_displayMode != DISPLAY_HEADLESS))
+		session.components.overlay2D->drawCircles(pts2dInliers, displayImage);
+
+	session.lastPose = frame->getPose();
+	updateMotionModel(session, frame->getPose());
+	session.isLostTrack = false;
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+void SolARSLAMTracking::updateMotionModel(Session &session, const Transform3Df &pose)
+{
+	if (session.hasLastTrackedPose) {
+		session.motion = session.lastTrackedPose.inverse() * pose;
+		session.isMotionValid = true;
+	}
+	session.lastTrackedPose = pose;
+	session.hasLastTrackedPose = true;
+}
+
+void SolARSLAMTracking::findLocalMapCandidates(Session &session, const SRef<Frame> frame, const std::vector<uint32_t> &idxCPSeen,
+											   std::vector<SRef<CloudPoint>> &localMapCandidates, std::vector<Point2Df> &projected2DPtsCandidates)
+{
+	SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_LOCAL_MAP_CULLING);
+	const LocalMapCache &cache = session.localMapCache;
+	const size_t nbPoints = cache.ids.size();
+	const Transform3Df &pose = frame->getPose();
+	const float camX = pose(0, 3), camY = pose(1, 3), camZ = pose(2, 3);
+	// the columns of the rotation are the rows of the world to camera rotation
+	const float r00 = pose(0, 0), r10 = pose(1, 0), r20 = pose(2, 0);
+	const float r01 = pose(0, 1), r11 = pose(1, 1), r21 = pose(2, 1);
+	const float r02 = pose(0, 2), r12 = pose(1, 2), r22 = pose(2, 2);
+	const float fx = m_camMatrix(0, 0), fy = m_camMatrix(1, 1), cx = m_camMatrix(0, 2), cy = m_camMatrix(1, 2);
+	const float imgWidth = static_cast<float>(frame->getView()->getWidth());
+	const float imgHeight = static_cast<float>(frame->getView()->getHeight());
+	const float minU = -LOCAL_MAP_IMAGE_MARGIN * imgWidth, maxU = (1.f + LOCAL_MAP_IMAGE_MARGIN) * imgWidth;
+	const float minV = -LOCAL_MAP_IMAGE_MARGIN * imgHeight, maxV = (1.f + LOCAL_MAP_IMAGE_MARGIN) * imgHeight;
+	const float thresAngle = m_thresAngleViewDirection;
+	// view angle and pinhole in-image tests in a single branchless pass over the arrays of the cache
+	std::vector<uint8_t> isVisible(nbPoints);
+	const float *x = cache.x.data(), *y = cache.y.data(), *z = cache.z.data();
+	const float *vx = cache.viewX.data(), *vy = cache.viewY.data(), *vz = cache.viewZ.data();
+	uint8_t *visible = isVisible.data();
+	for (size_t i = 0; i < nbPoints; ++i) {
+		float dx = camX - x[i], dy = camY - y[i], dz = camZ - z[i];
+		float dist = std::sqrt(dx * dx + dy * dy + dz * dz);
+		float cosine = vx[i] * dx + vy[i] * dy + vz[i] * dz;
+		float xc = -(r00 * dx + r10 * dy + r20 * dz);
+		float yc = -(r01 * dx + r11 * dy + r21 * dz);
+		float zc = -(r02 * dx + r12 * dy + r22 * dz);
+		float u = fx * xc + cx * zc;
+		float v = fy * yc + cy * zc;
+		visible[i] = (cosine > thresAngle * dist) & (zc > 0.f) & (u > minU * zc) & (u < maxU * zc) & (v > minV * zc) & (v < maxV * zc);
+	}
+	for (const auto &id : idxCPSeen) {
+		auto it = cache.indices.find(id);
+		if (it != cache.indices.end())
+			isVisible[it->second] = 0;
+	}
+	std::vector<SRef<CloudPoint>> localMapUnseen;
+	for (size_t i = 0; i < nbPoints; ++i)
+		if (isVisible[i])
+			localMapUnseen.push_back(cache.points[i]);
+	// keep the most confident candidates if the latency budget is being spent
+	if ((localMapUnseen.size() > static_cast<size_t>(m_degradedMaxCandidates)) && applyDegradation(session, DEGRADATION_CAP_CANDIDATES)) {
+		// the confidences are read once, they can be updated concurrently by the other sessions
+		std::vector<float> confidences(localMapUnseen.size());
+		std::vector<uint32_t> indices(localMapUnseen.size());
+		for (uint32_t i = 0; i < localMapUnseen.size(); ++i) {
+			confidences[i] = localMapUnseen[i]->getConfidence();
+			indices[i] = i;
+		}
+		std::nth_element(indices.begin(), indices.begin() + m_degradedMaxCandidates, indices.end(),
+			[&confidences](uint32_t i1, uint32_t i2) { return confidences[i1] > confidences[i2]; });
+		indices.resize(m_degradedMaxCandidates);
+		std::vector<SRef<CloudPoint>> candidates;
+		candidates.reserve(indices.size());
+		for (const auto &i : indices)
+			candidates.push_back(localMapUnseen[i]);
+		localMapUnseen.swap(candidates);
+	}
+	//  projection points and filter point out of frame
+	timer.next(STAGE_PROJECTION);
+	if (localMapUnseen.size() > 0) {
+		std::vector< Point2Df > projected2DPts;
+		session.components.projector->project(localMapUnseen, projected2DPts, frame->getPose());
+		uint32_t imgWidth = frame->getView()->getWidth();
+		uint32_t imgHeight = frame->getView()->getHeight();
+		for (int idx = 0; idx < projected2DPts.size(); idx++)
+			if ((projected2DPts[idx].getX() > 0) && (projected2DPts[idx].getX() < imgWidth) && (projected2DPts[idx].getY() > 0) && (projected2DPts[idx].getY() < imgHeight)) {
+				projected2DPtsCandidates.push_back(std::move(projected2DPts[idx]));
+				localMapCandidates.push_back(std::move(localMapUnseen[idx]));
+			}
+	}
+}
+
+void SolARSLAMTracking::matchLocalMap(Session &session, const std::vector<SRef<CloudPoint>> &localMapCandidates, const std::vector<Point2Df> &projected2DPtsCandidates,
+									  const SRef<Frame> frame, const float radius, const float matchingDistanceMax, std::vector<DescriptorMatch> &matches)
+{
+	SolARStageProfiler::ScopedTimer timer(m_profiler, STAGE_REGION_MATCHING);
+	std::vector<SRef<DescriptorBuffer>> descriptors;
+	for (auto &it_cp : localMapCandidates)
+		descriptors.push_back(it_cp->getDescriptor());
+	float searchRadius = radius;
+	if (applyDegradation(session, DEGRADATION_SHRINK_RADIUS))
+		searchRadius = (radius > 0.f ? radius : m_searchRadius) * m_degradedSearchRadiusRatio;
+	if (m_keypointGridCellSize > 0) {
+		// the grid is built once per frame and reused by the following searches
+		if (session.gridFrame != frame) {
+			buildKeypointGrid(session, frame);
+			session.gridFrame = frame;
+		}
+		matchInGrid(session, projected2DPtsCandidates, descriptors, frame, matches, searchRadius > 0.f ? searchRadius : m_searchRadius, matchingDistanceMax);
+	}
+	else
+		session.components.matcher->matchInRegion(projected2DPtsCandidates, descriptors, frame, matches, searchRadius, matchingDistanceMax);
+}
+
+void SolARSLAMTracking::buildKeypointGrid(Session &session, const SRef<Frame> frame)
+{
+	const std::vector<Keypoint> &keypoints = frame->getKeypoints();
+	const float cellSize = static_cast<float>(m_keypointGridCellSize);
+	session.gridNbCols = std::max(1, static_cast<int>(std::ceil(frame->getView()->getWidth() / cellSize)));
+	session.gridNbRows = std::max(1, static_cast<int>(std::ceil(frame->getView()->getHeight() / cellSize)));
+	// counting sort of the keypoints by cell
+	std::vector<uint32_t> keypointCells(keypoints.size());
+	session.gridCellStarts.assign(session.gridNbCols * session.gridNbRows + 1, 0);
+	for (uint32_t i = 0; i < keypoints.size(); ++i) {
+		int col = std::min(std::max(static_cast<int>(keypoints[i].getX() / cellSize), 0), session.gridNbCols - 1);
+		int row = std::min(std::max(static_cast<int>(keypoints[i].getY() / cellSize), 0), session.gridNbRows - 1);
+		keypointCells[i] = row * session.gridNbCols + col;
+		session.gridCellStarts[keypointCells[i] + 1]++;
+	}
+	for (size_t i = 1; i < session.gridCellStarts.size(); ++i)
+		session.gridCellStarts[i] += session.gridCellStarts[i - 1];
+	std::vector<uint32_t> cellPositions(session.gridCellStarts.begin(), session.gridCellStarts.end() - 1);
+	session.gridKeypointIndices.resize(keypoints.size());
+	for (uint32_t i = 0; i < keypoints.size(); ++i)
+		session.gridKeypointIndices[cellPositions[keypointCells[i]]++] = i;
+}
+
+void SolARSLAMTracking::matchInGrid(Session &session, const std::vector<Point2Df> &points2D, const std::vector<SRef<DescriptorBuffer>> &descriptors,
+									const SRef<Frame> frame, std::vector<DescriptorMatch> &matches, const float radius, const float matchingDistanceMax)
+{
+	const std::vector<Keypoint> &keypoints = frame->getKeypoints();
+	const SRef<DescriptorBuffer> &frameDescriptors = frame->getDescriptors();
+	const float cellSize = static_cast<float>(m_keypointGridCellSize);
+	const float squaredRadius = radius * radius;
+	// best projected point of each keypoint
+	std::vector<int> keypointPoints(keypoints.size(), -1);
+	std::vector<float> keypointDistances(keypoints.size(), FLT_MAX);
+	for (int i = 0; i < points2D.size(); ++i) {
+		const SRef<DescriptorBuffer> &descriptor = descriptors[i];
+		if ((descriptor->getDescriptorType() != frameDescriptors->getDescriptorType()) ||
+			(descriptor->getDescriptorDataType() != frameDescriptors->getDescriptorDataType()) ||
+			(descriptor->getDescriptorByteSize() != frameDescriptors->getDescriptorByteSize()))
+			continue;
+		const float x = points2D[i].getX();
+		const float y = points2D[i].getY();
+		// only the cells intersecting the search region are visited
+		int minCol = std::max(static_cast<int>((x - radius) / cellSize), 0);
+		int maxCol = std::min(static_cast<int>((x + radius) / cellSize), session.gridNbCols - 1);
+		int minRow = std::max(static_cast<int>((y - radius) / cellSize), 0);
+		int maxRow = std::min(static_cast<int>((y + radius) / cellSize), session.gridNbRows - 1);
+		int bestKeypoint(-1);
+		float bestDistance = matchingDistanceMax;
+		for (int row = minRow; row <= maxRow; ++row)
+			for (int col = minCol; col <= maxCol; ++col) {
+				int cell = row * session.gridNbCols + col;
+				for (uint32_t k = session.gridCellStarts[cell]; k < session.gridCellStarts[cell + 1]; ++k) {
+					uint32_t idxKeypoint = session.gridKeypointIndices[k];
+					float dx = keypoints[idxKeypoint].getX() - x;
+					float dy = keypoints[idxKeypoint].getY() - y;
+					if (dx * dx + dy * dy > squaredRadius)
+						continue;
+					float distance = descriptorDistance(descriptor, 0, frameDescriptors, idxKeypoint, false);
+					if (distance <= bestDistance) {
+						bestDistance = distance;
+						bestKeypoint = idxKeypoint;
+					}
+				}
+			}
+		if ((bestKeypoint >= 0) && (bestDistance < keypointDistances[bestKeypoint])) {
+			keypointPoints[bestKeypoint] = i;
+			keypointDistances[bestKeypoint] = bestDistance;
+		}
+	}
+	matches.clear();
+	for (uint32_t i = 0; i < keypoints.size(); ++i)
+		if (keypointPoints[i] >= 0)
+			matches.push_back(DescriptorMatch(keypointPoints[i], i, keypointDistances[i]));
+}
+
+void SolARSLAMTracking::updateConfidences(const std::vector<SRef<CloudPoint>> &cloudPoints, const std::vector<bool> &isInliers)
+{
+	// the cloud points of the map are shared by the sessions, their confidences are updated by the mapper under its lock
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	if (mapper) {
+		mapper->updateConfidences(cloudPoints, isInliers);
+		return;
+	}
+	std::unique_lock<std::mutex> lock(m_confidenceMutex);
+	for (size_t i = 0; i < cloudPoints.size(); ++i)
+		cloudPoints[i]->updateConfidence(isInliers[i]);
+}
+
+void SolARSLAMTracking::initDisplayImage(Session &session, const SRef<Frame> frame, SRef<Image> &displayImage)
 {
-	std::unique_lock<std::mutex> lock(m_refKeyframeMutex);
-	m_localMap.clear();
-	// get local point cloud
-	m_mapper->getLocalPointCloud(m_referenceKeyframe, m_minWeightNeighbor, m_localMap);
-	m_lastPose = m_referenceKeyframe->getPose();
-	m_isUpdateReferenceKeyframe = false;
+	const SRef<Image> &view = frame->getView();
+	if (m_displayMode == DISPLAY_HEADLESS) {
+		// nothing is drawn, the frame image is returned without copy
+		displayImage = view;
+		return;
+	}
+	if (m_displayMode != DISPLAY_POOLED) {
+		displayImage = view->copy();
+		return;
+	}
+	auto isSameFormat = [&view](const SRef<Image> &image) {
+		return (image->getWidth() == view->getWidth()) && (image->getHeight() == view->getHeight()) &&
+			(image->getImageLayout() == view->getImageLayout()) && (image->getPixelOrder() == view->getPixelOrder()) &&
+			(image->getDataType() == view->getDataType());
+	};
+	// reuse an image of the pool with the same format which is no longer held by the caller, the previous display image is released first
+	displayImage = nullptr;
+	for (const auto &image : session.displayImagePool)
+		if ((image.use_count() == 1) && isSameFormat(image)) {
+			displayImage = image;
+			std::memcpy(displayImage->data(), view->data(), view->getBufferSize());
+			return;
+		}
+	// the images of another format are released
+	session.displayImagePool.erase(std::remove_if(session.displayImagePool.begin(), session.displayImagePool.end(), [&isSameFormat](const SRef<Image> &image) {
+		return !isSameFormat(image); }), session.displayImagePool.end());
+	displayImage = view->copy();
+	session.displayImagePool.push_back(displayImage);
+	LOG_DEBUG("Nb of images of the display pool: {}", session.displayImagePool.size());
+}
+
+FrameworkReturnCode SolARSLAMTracking::relocalize(Session &session, const SRef<Frame> frame)
+{
+	std::vector < uint32_t> retKeyframesId;
+	SRef<Keyframe> bestRetKeyframe;
+	std::unique_lock<std::mutex> retrieverLock(m_retrieverMutex);
+	FrameworkReturnCode retrieved = m_keyframeRetriever->retrieve(frame, retKeyframesId);
+	retrieverLock.unlock();
+	if (retrieved == FrameworkReturnCode::_SUCCESS) {
+		// the retriever can return keyframes evicted from the map
+		for (const auto &it : retKeyframesId)
+			if (m_keyframesManager->getKeyframe(it, bestRetKeyframe) == FrameworkReturnCode::_SUCCESS)
+				break;
+			else
+				bestRetKeyframe = nullptr;
+	}
+	if (!bestRetKeyframe) {
+		LOG_DEBUG("Relocalization Failed");
+		return FrameworkReturnCode::_ERROR_;
+	}
+	LOG_DEBUG("Successful relocalization. Update reference keyframe id: {}", bestRetKeyframe->getId());
+	updateReferenceKeyframe(session.id, bestRetKeyframe);
+	return FrameworkReturnCode::_SUCCESS;
+}
+
+void SolARSLAMTracking::postRelocalization(const uint32_t sessionId, const SRef<Frame> frame)
+{
+	std::unique_lock<std::mutex> lock(m_relocMutex);
+	// the sessions are served in the order they got lost, a session keeps its turn when its waiting frame is replaced
+	if (m_relocFrames.find(sessionId) != m_relocFrames.end())
+		LOG_DEBUG("Drop the stale lost frame of session {} waiting for relocalization", sessionId);
+	else
+		m_relocOrder.push_back(sessionId);
+	m_relocFrames[sessionId] = frame;
+	// the relocalization thread is started by the first lost frame
+	if (!m_isRelocRunning) {
+		m_isRelocRunning = true;
+		m_relocThread = std::thread([this]() {
+			std::unique_lock<std::mutex> lock(m_relocMutex);
+			while (m_isRelocRunning) {
+				m_relocCondition.wait(lock, [this]() { return !m_isRelocRunning || !m_relocOrder.empty(); });
+				if (m_relocOrder.empty())
+					continue;
+				uint32_t sessionId = m_relocOrder.front();
+				m_relocOrder.pop_front();
+				auto itFrame = m_relocFrames.find(sessionId);
+				SRef<Frame> frame = itFrame->second;
+				m_relocFrames.erase(itFrame);
+				lock.unlock();
+				// the session may have been destroyed or the front-end may have recovered by itself while the frame was waiting
+				SRef<Session> session = getSession(sessionId);
+				// the relocalization does not use the components of the session, so the tracking of the session is not blocked
+				if (session && session->isLostTrack)
+					relocalize(*session, frame);
+				lock.lock();
+			}
+		});
+	}
+	lock.unlock();
+	m_relocCondition.notify_one();
+}
+
+void SolARSLAMTracking::updateLocalMap(Session &session)
+{
+	std::unique_lock<std::mutex> lock(session.refKeyframeMutex);
+	// the ids of the local map cannot be compared with the ones of the map once it has been reset, by a compaction for instance
+	SRef<SolARMapper> mapper = std::dynamic_pointer_cast<SolARMapper>(m_mapper);
+	uint64_t resetVersion = mapper ? mapper->getResetVersion() : 0;
+	bool isSameMap = (resetVersion == session.mapResetVersion);
+	session.mapResetVersion = resetVersion;
+	// the motion and the matching distance of the session are not valid in a reset map
+	if (!isSameMap) {
+		session.isMotionValid = false;
+		session.hasLastTrackedPose = false;
+		session.lastMaxMatchDistance = 0.f;
+	}
+	// the keyframe may have been replaced by a clone modified by the mapper while the map is shared with a fork
+	SRef<Keyframe> currentKeyframe;
+	if (isSameMap && (m_keyframesManager->getKeyframe(session.referenceKeyframe->getId(), currentKeyframe) == FrameworkReturnCode::_SUCCESS))
+		session.referenceKeyframe = currentKeyframe;
+	// the local maps of neighboring keyframes mostly overlap, so only apply the changes when the mapper provides them
+	bool isUpdated = false;
+	if (mapper && isSameMap && !session.localMap.empty()) {
+		std::vector<SRef<CloudPoint>> addedPoints;
+		std::vector<uint32_t> removedPointIds;
+		if (mapper->getLocalPointCloudDelta(session.localMap, session.referenceKeyframe, m_minWeightNeighbor, addedPoints, removedPointIds) == FrameworkReturnCode::_SUCCESS) {
+			session.localMap.erase(std::remove_if(session.localMap.begin(), session.localMap.end(), [&removedPointIds](const SRef<CloudPoint> &cp) {
+				return std::binary_search(removedPointIds.begin(), removedPointIds.end(), cp->getId()); }), session.localMap.end());
+			session.localMap.insert(session.localMap.end(), addedPoints.begin(), addedPoints.end());
+			isUpdated = true;
+		}
+	}
+	if (!isUpdated) {
+		session.localMap.clear();
+		// get local point cloud
+		m_mapper->getLocalPointCloud(session.referenceKeyframe, m_minWeightNeighbor, session.localMap);
+	}
+	// rebuild the cache of the local map
+	LocalMapCache &cache = session.localMapCache;
+	const size_t nbPoints = session.localMap.size();
+	cache.points = session.localMap;
+	for (auto array : { &cache.x, &cache.y, &cache.z, &cache.viewX, &cache.viewY, &cache.viewZ })
+		array->resize(nbPoints);
+	cache.ids.resize(nbPoints);
+	cache.indices.clear();
+	cache.indices.reserve(nbPoints);
+	for (uint32_t i = 0; i < nbPoints; ++i) {
+		const SRef<CloudPoint> &cp = session.localMap[i];
+		const Vector3f &viewDir = cp->getViewDirection();
+		cache.x[i] = cp->getX();
+		cache.y[i] = cp->getY();
+		cache.z[i] = cp->getZ();
+		cache.viewX[i] = viewDir(0);
+		cache.viewY[i] = viewDir(1);
+		cache.viewZ[i] = viewDir(2);
+		cache.ids[i] = cp->getId();
+		cache.indices[cp->getId()] = i;
+	}
+	session.lastPose = session.referenceKeyframe->getPose();
+	session.isUpdateReferenceKeyframe = false;
 }
 
 }
@@ -0,0 +1,98 @@
+/**
+ * @copyright Copyright (c) 2017 B-com http://www.b-com.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SolARStageProfiler.h"
+#include "core/Log.h"
+#include <algorithm>
+#include <sstream>
+
+namespace SolAR {
+namespace MODULES {
+namespace TOOLS {
+
+SolARStageProfiler::SolARStageProfiler(const std::string &name, const std::vector<std::string> &stageNames, const uint32_t windowSize) :
+	m_name(name), m_stageNames(stageNames), m_stages(stageNames.size()), m_windowSize(std::max(windowSize, 1u))
+{
+	for (auto &stage : m_stages)
+		stage.window.reserve(m_windowSize);
+}
+
+void SolARStageProfiler::addSample(const int stage, const float duration)
+{
+	if ((stage < 0) || (stage >= static_cast<int>(m_stages.size())))
+		return;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Stage &s = m_stages[stage];
+	if (s.window.size() < m_windowSize)
+		s.window.push_back(duration);
+	else
+		s.window[s.next] = duration;
+	s.next = (s.next + 1) % m_windowSize;
+	s.count++;
+	s.total += duration;
+}
+
+void SolARStageProfiler::endFrame()
+{
+	if (!m_isEnabled || (m_logPeriod == 0) || (++m_nbFrames % m_logPeriod != 0))
+		return;
+	std::vector<StageStatistics> statistics;
+	getStatistics(statistics);
+	std::ostringstream line;
+	line.precision(3);
+	line << std::fixed;
+	for (const auto &it : statistics)
+		if (it.count > 0)
+			line << " " << it.name << " " << it.p50 << "/" << it.p90 << "/" << it.p99;
+	LOG_INFO("{} stage latencies in ms (p50/p90/p99):{}", m_name, line.str());
+}
+
+void SolARStageProfiler::getStatistics(std::vector<StageStatistics> &statistics) const
+{
+	statistics.clear();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (size_t i = 0; i < m_stages.size(); ++i) {
+		const Stage &s = m_stages[i];
+		StageStatistics stageStatistics;
+		stageStatistics.name = m_stageNames[i];
+		stageStatistics.count = s.count;
+		if (!s.window.empty()) {
+			std::vector<float> sorted(s.window);
+			std::sort(sorted.begin(), sorted.end());
+			auto percentile = [&sorted](const float p) {
+				return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5f)];
+			};
+			stageStatistics.mean = static_cast<float>(s.total / s.count);
+			stageStatistics.p50 = percentile(0.5f);
+			stageStatistics.p90 = percentile(0.9f);
+			stageStatistics.p99 = percentile(0.99f);
+			stageStatistics.max = sorted.back();
+		}
+		statistics.push_back(stageStatistics);
+	}
+}
+
+void SolARStageProfiler::reset()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (auto &stage : m_stages)
+		stage = Stage();
+	m_nbFrames = 0;
+}
+
+}
+}
+}
@@ -0,0 +1,248 @@
+/**
+ * @copyright Copyright (c) 2017 B-com http://www.b-com.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <boost/log/core.hpp>
+#include "xpcf/xpcf.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cmath>
+#include <set>
+#include <tuple>
+#include <algorithm>
+#include <xpcf/api/IComponentManager.h>
+#include <xpcf/core/helpers.h>
+#include <api/storage/ICovisibilityGraph.h>
+#include "core/Log.h"
+
+namespace xpcf = org::bcom::xpcf;
+using namespace SolAR;
+using namespace SolAR::datastructure;
+using namespace SolAR::api;
+
+// a synthetic covisibility edge
+struct SyntheticEdge {
+	uint32_t node1;
+	uint32_t node2;
+	float weight;
+};
+
+// a timing result of an operation
+struct BenchmarkResult {
+	std::string implementation;
+	uint32_t nbKeyframes;
+	size_t nbEdges;
+	std::string operation;
+	size_t count;
+	double totalMs;
+	bool skipped;
+};
+
+// Generate a synthetic covisibility graph close to the ones built by a SLAM pipeline:
+// - each keyframe is strongly connected to the few keyframes captured just before it,
+// - the camera regularly revisits older areas which creates loop connections,
+// - some keyframes become hubs which gain many weak edges (preferential attachment).
+static std::vector<SyntheticEdge> generateGraph(const uint32_t nbKeyframes, std::mt19937 &rng)
+{
+	const int temporalWindow = 8;
+	const float loopProbability = 0.05f;
+	const int nbWeakEdges = 3;
+	std::vector<SyntheticEdge> edges;
+	// list of edge extremities, used to sample nodes proportionally to their degree
+	std::vector<uint32_t> endpoints;
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	std::uniform_int_distribution<int> weakWeight(1, 5);
+	for (uint32_t i = 1; i < nbKeyframes; ++i) {
+		// temporal neighbors with decreasing weights
+		for (int d = 1; d <= temporalWindow && d <= static_cast<int>(i); ++d) {
+			float weight = std::floor(200.f * std::exp(-0.5f * d) * (0.5f + uniform(rng))) + 1.f;
+			edges.push_back({ i, i - d, weight });
+			endpoints.push_back(i);
+			endpoints.push_back(i - d);
+		}
+		// loop connections with an older area
+		if ((i > 10 * temporalWindow) && (uniform(rng) < loopProbability)) {
+			uint32_t center = std::uniform_int_distribution<uint32_t>(0, i - 5 * temporalWindow)(rng);
+			for (int d = 0; d < temporalWindow / 2; ++d) {
+				edges.push_back({ i, center + d, std::floor(60.f * uniform(rng)) + 15.f });
+				endpoints.push_back(i);
+				endpoints.push_back(center + d);
+			}
+		}
+		// weak edges to hub keyframes
+		for (int w = 0; w < nbWeakEdges; ++w) {
+			uint32_t target = endpoints[std::uniform_int_distribution<size_t>(0, endpoints.size() - 1)(rng)];
+			if (target == i)
+				continue;
+			edges.push_back({ i, target, static_cast<float>(weakWeight(rng)) });
+			endpoints.push_back(i);
+			endpoints.push_back(target);
+		}
+	}
+	std::shuffle(edges.begin() + edges.size() / 2, edges.end(), rng);
+	return edges;
+}
+
+static double elapsedMs(const std::chrono::steady_clock::time_point &start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void benchmarkImplementation(SRef<xpcf::IComponentManager> xpcfComponentManager, const std::string &implementation,
+									const uint32_t nbKeyframes, const std::vector<SyntheticEdge> &edges, const uint32_t maxSpanningTreeNodes,
+									std::vector<BenchmarkResult> &results)
+{
+	const size_t nbQueries = 1000;
+	const size_t nbPathQueries = 20;
+	const size_t nbSuppressions = 100;
+	auto covisibilityGraph = xpcfComponentManager->resolve<storage::ICovisibilityGraph>(implementation.c_str());
+	auto addResult = [&](const std::string &operation, size_t count, double totalMs, bool skipped = false) {
+		results.push_back({ implementation, nbKeyframes, edges.size(), operation, count, totalMs, skipped });
+		LOG_INFO("{} - {} keyframes - {}: {} ops in {} ms", implementation, nbKeyframes, operation, count, totalMs);
+	};
+	std::mt19937 rng(42);
+	std::uniform_int_distribution<uint32_t> randomNode(0, nbKeyframes - 1);
+
+	// build the graph: each call creates or increases an edge
+	auto start = std::chrono::steady_clock::now();
+	for (const auto &e : edges)
+		covisibilityGraph->increaseEdge(e.node1, e.node2, e.weight);
+	addResult("increaseEdge", edges.size(), elapsedMs(start));
+
+	// the most frequent call in a SLAM pipeline increases an existing edge by 1
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < edges.size(); ++i)
+		covisibilityGraph->increaseEdge(edges[i].node1, edges[i].node2, 1.f);
+	addResult("increaseExistingEdge", edges.size(), elapsedMs(start));
+
+	// neighbors queries with the thresholds used by tracking and mapping
+	for (float minWeight : { 1.f, 10.f }) {
+		std::vector<uint32_t> queries(nbQueries);
+		for (auto &q : queries)
+			q = randomNode(rng);
+		start = std::chrono::steady_clock::now();
+		for (const auto &q : queries) {
+			std::vector<uint32_t> neighbors;
+			covisibilityGraph->getNeighbors(q, minWeight, neighbors);
+		}
+		std::ostringstream operation;
+		operation << "getNeighbors_minWeight" << minWeight;
+		addResult(operation.str(), nbQueries, elapsedMs(start));
+	}
+
+	// shortest paths between random keyframes
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < nbPathQueries; ++i) {
+		std::vector<uint32_t> path;
+		uint32_t node1 = randomNode(rng);
+		uint32_t node2 = randomNode(rng);
+		if (node1 != node2)
+			covisibilityGraph->getShortestPath(node1, node2, path);
+	}
+	addResult("getShortestPath", nbPathQueries, elapsedMs(start));
+
+	// spanning trees
+	bool skipSpanningTree = nbKeyframes > maxSpanningTreeNodes;
+	std::vector<std::tuple<uint32_t, uint32_t, float>> edgesWeights;
+	float totalWeights;
+	start = std::chrono::steady_clock::now();
+	if (!skipSpanningTree)
+		covisibilityGraph->maximalSpanningTree(edgesWeights, totalWeights);
+	addResult("maximalSpanningTree", skipSpanningTree ? 0 : 1, elapsedMs(start), skipSpanningTree);
+	edgesWeights.clear();
+	start = std::chrono::steady_clock::now();
+	if (!skipSpanningTree)
+		covisibilityGraph->minimalSpanningTree(edgesWeights, totalWeights);
+	addResult("minimalSpanningTree", skipSpanningTree ? 0 : 1, elapsedMs(start), skipSpanningTree);
+
+	// save and load
+	std::string fileName = "covisibility_graph_benchmark_" + implementation + ".bin";
+	start = std::chrono::steady_clock::now();
+	covisibilityGraph->saveToFile(fileName);
+	addResult("saveToFile", 1, elapsedMs(start));
+	auto loadedGraph = xpcfComponentManager->resolve<storage::ICovisibilityGraph>(implementation.c_str());
+	start = std::chrono::steady_clock::now();
+	loadedGraph->loadFromFile(fileName);
+	addResult("loadFromFile", 1, elapsedMs(start));
+	std::remove(fileName.c_str());
+
+	// suppress nodes
+	std::set<uint32_t> toSuppress;
+	while (toSuppress.size() < std::min<size_t>(nbSuppressions, nbKeyframes / 2))
+		toSuppress.insert(randomNode(rng));
+	start = std::chrono::steady_clock::now();
+	for (const auto &n : toSuppress)
+		covisibilityGraph->suppressNode(n);
+	addResult("suppressNode", toSuppress.size(), elapsedMs(start));
+}
+
+static void saveResults(const std::string &fileName, const std::vector<BenchmarkResult> &results)
+{
+	std::ofstream ofs(fileName);
+	ofs << "[" << std::endl;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchmarkResult &r = results[i];
+		ofs << "  {\"implementation\": \"" << r.implementation << "\", \"keyframes\": " << r.nbKeyframes
+			<< ", \"edges\": " << r.nbEdges << ", \"operation\": \"" << r.operation << "\", \"count\": " << r.count
+			<< ", \"total_ms\": " << r.totalMs << ", \"mean_us\": " << (r.count > 0 ? 1000.0 * r.totalMs / r.count : 0.0)
+			<< ", \"skipped\": " << (r.skipped ? "true" : "false") << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	ofs << "]" << std::endl;
+	ofs.close();
+}
+
+int main(int argc, char* argv[])
+{
+#if NDEBUG
+	boost::log::core::get()->set_logging_enabled(false);
+#endif
+	LOG_ADD_LOG_TO_CONSOLE();
+	SRef<xpcf::IComponentManager> xpcfComponentManager = xpcf::getComponentManagerInstance();
+
+	if (xpcfComponentManager->load("SolARTest_ModuleTools_CovisibilityGraphBenchmark_conf.xml") != org::bcom::xpcf::_SUCCESS)
+	{
+		std::cerr << "Failed to load the configuration file SolARTest_ModuleTools_CovisibilityGraphBenchmark_conf.xml" << std::endl;
+		return -1;
+	}
+
+	// usage: SolARTest_ModuleTools_CovisibilityGraphBenchmark [output.json] [nbKeyframes ...]
+	std::string outputFileName = "covisibility_graph_benchmark.json";
+	std::vector<uint32_t> sizes;
+	if (argc > 1)
+		outputFileName = argv[1];
+	for (int i = 2; i < argc; ++i)
+		sizes.push_back(static_cast<uint32_t>(std::stoul(argv[i])));
+	if (sizes.empty())
+		sizes = { 1000, 10000, 100000 };
+	// spanning trees of SolARCovisibilityGraph are quadratic in the number of nodes
+	const uint32_t maxSpanningTreeNodes = 20000;
+
+	std::vector<BenchmarkResult> results;
+	for (const auto &nbKeyframes : sizes) {
+		std::mt19937 rng(nbKeyframes);
+		std::vector<SyntheticEdge> edges = generateGraph(nbKeyframes, rng);
+		LOG_INFO("Synthetic graph: {} keyframes, {} edge updates", nbKeyframes, edges.size());
+		for (const std::string implementation : { "SolARCovisibilityGraph", "SolARBoostCovisibilityGraph" })
+			benchmarkImplementation(xpcfComponentManager, implementation, nbKeyframes, edges, maxSpanningTreeNodes, results);
+	}
+	saveResults(outputFileName, results);
+	std::cout << "Benchmark results saved to " << outputFileName << std::endl;
+
+	return 0;
+}
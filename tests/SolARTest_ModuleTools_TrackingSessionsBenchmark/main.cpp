@@ -0,0 +1,196 @@
+/**
+ * @copyright Copyright (c) 2017 B-com http://www.b-com.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <boost/log/core.hpp>
+#include "xpcf/xpcf.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <xpcf/api/IComponentManager.h>
+#include <xpcf/core/helpers.h>
+#include "api/input/devices/ICamera.h"
+#include "api/solver/map/IMapper.h"
+#include "api/storage/IKeyframesManager.h"
+#include "api/slam/ITracking.h"
+#include "SolARSLAMTracking.h"
+#include "core/Log.h"
+
+namespace xpcf = org::bcom::xpcf;
+using namespace SolAR;
+using namespace SolAR::datastructure;
+using namespace SolAR::api;
+using namespace SolAR::MODULES::TOOLS;
+
+// the timing results of a run with several sessions
+struct BenchmarkResult {
+	uint32_t nbSessions;
+	size_t nbFrames;
+	size_t nbTrackedFrames;
+	double wallMs;
+	double meanLatencyMs;
+	double p99LatencyMs;
+};
+
+static double elapsedMs(const std::chrono::steady_clock::time_point &start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Run nbSessions sessions of the same tracking component concurrently, each one on its own thread with its own components.
+// The keyframes of the prebuilt map are replayed as frames, each session starting at a different keyframe.
+static BenchmarkResult benchmarkSessions(SRef<xpcf::IComponentManager> xpcfComponentManager, SRef<SolARSLAMTracking> tracking,
+										 const std::vector<SRef<Keyframe>> &keyframes, const SRef<Image> blankImage,
+										 const uint32_t nbSessions, const size_t nbFramesPerSession)
+{
+	std::vector<uint32_t> sessionIds(nbSessions);
+	for (uint32_t i = 0; i < nbSessions; ++i) {
+		SolARSLAMTracking::SessionComponents components;
+		components.matcher = xpcfComponentManager->resolve<features::IDescriptorMatcher>();
+		components.matchesFilter = xpcfComponentManager->resolve<features::IMatchesFilter>();
+		components.corr2D3DFinder = xpcfComponentManager->resolve<solver::pose::I2D3DCorrespondencesFinder>();
+		components.pnpRansac = xpcfComponentManager->resolve<solver::pose::I3DTransformSACFinderFrom2D3D>();
+		components.pnp = xpcfComponentManager->resolve<solver::pose::I3DTransformFinderFrom2D3D>();
+		components.projector = xpcfComponentManager->resolve<geom::IProject>();
+		components.overlay2D = xpcfComponentManager->resolve<display::I2DOverlay>();
+		tracking->createSession(sessionIds[i], components);
+	}
+
+	std::vector<std::vector<double>> latencies(nbSessions);
+	std::vector<size_t> nbTracked(nbSessions, 0);
+	std::vector<std::thread> threads;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < nbSessions; ++i) {
+		threads.emplace_back([&, i]() {
+			size_t offset = i * keyframes.size() / nbSessions;
+			tracking->updateReferenceKeyframe(sessionIds[i], keyframes[offset]);
+			latencies[i].reserve(nbFramesPerSession);
+			for (size_t f = 0; f < nbFramesPerSession; ++f) {
+				const SRef<Keyframe> &keyframe = keyframes[(offset + f) % keyframes.size()];
+				SRef<Image> view = keyframe->getView() ? keyframe->getView() : blankImage;
+				SRef<Frame> frame = xpcf::utils::make_shared<Frame>(keyframe->getKeypoints(), keyframe->getDescriptors(), view, keyframe);
+				SRef<Image> displayImage;
+				auto frameStart = std::chrono::steady_clock::now();
+				if (tracking->process(sessionIds[i], frame, displayImage) == FrameworkReturnCode::_SUCCESS)
+					nbTracked[i]++;
+				latencies[i].push_back(elapsedMs(frameStart));
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	double wallMs = elapsedMs(start);
+	for (const auto &id : sessionIds)
+		tracking->destroySession(id);
+
+	std::vector<double> allLatencies;
+	for (const auto &l : latencies)
+		allLatencies.insert(allLatencies.end(), l.begin(), l.end());
+	std::sort(allLatencies.begin(), allLatencies.end());
+	BenchmarkResult result;
+	result.nbSessions = nbSessions;
+	result.nbFrames = allLatencies.size();
+	result.nbTrackedFrames = 0;
+	for (const auto &n : nbTracked)
+		result.nbTrackedFrames += n;
+	result.wallMs = wallMs;
+	result.meanLatencyMs = 0.0;
+	for (const auto &l : allLatencies)
+		result.meanLatencyMs += l;
+	result.meanLatencyMs /= std::max<size_t>(allLatencies.size(), 1);
+	result.p99LatencyMs = allLatencies.empty() ? 0.0 : allLatencies[std::min(allLatencies.size() - 1, allLatencies.size() * 99 / 100)];
+	LOG_INFO("{} sessions: {} frames ({} tracked) in {} ms, {} fps, mean latency {} ms, p99 latency {} ms",
+		nbSessions, result.nbFrames, result.nbTrackedFrames, wallMs, 1000.0 * result.nbFrames / wallMs, result.meanLatencyMs, result.p99LatencyMs);
+	return result;
+}
+
+static void saveResults(const std::string &fileName, const std::vector<BenchmarkResult> &results)
+{
+	std::ofstream ofs(fileName);
+	ofs << "[" << std::endl;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchmarkResult &r = results[i];
+		ofs << "  {\"sessions\": " << r.nbSessions << ", \"frames\": " << r.nbFrames << ", \"tracked_frames\": " << r.nbTrackedFrames
+			<< ", \"wall_ms\": " << r.wallMs << ", \"throughput_fps\": " << (r.wallMs > 0 ? 1000.0 * r.nbFrames / r.wallMs : 0.0)
+			<< ", \"mean_latency_ms\": " << r.meanLatencyMs << ", \"p99_latency_ms\": " << r.p99LatencyMs << "}"
+			<< (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+	ofs << "]" << std::endl;
+	ofs.close();
+}
+
+int main(int argc, char* argv[])
+{
+#if NDEBUG
+	boost::log::core::get()->set_logging_enabled(false);
+#endif
+	LOG_ADD_LOG_TO_CONSOLE();
+	SRef<xpcf::IComponentManager> xpcfComponentManager = xpcf::getComponentManagerInstance();
+
+	// load the installed module registries, then the bindings and properties of the benchmark
+	xpcfComponentManager->load();
+	if (xpcfComponentManager->load("SolARTest_ModuleTools_TrackingSessionsBenchmark_conf.xml") != org::bcom::xpcf::_SUCCESS)
+	{
+		std::cerr << "Failed to load the configuration file SolARTest_ModuleTools_TrackingSessionsBenchmark_conf.xml" << std::endl;
+		return -1;
+	}
+
+	// usage: SolARTest_ModuleTools_TrackingSessionsBenchmark [output.json] [nbSessions ...]
+	std::string outputFileName = "tracking_sessions_benchmark.json";
+	std::vector<uint32_t> nbSessionsList;
+	if (argc > 1)
+		outputFileName = argv[1];
+	for (int i = 2; i < argc; ++i)
+		nbSessionsList.push_back(static_cast<uint32_t>(std::stoul(argv[i])));
+	if (nbSessionsList.empty())
+		nbSessionsList = { 1, 8, 32 };
+	const size_t nbFramesPerSession = 200;
+
+	auto camera = xpcfComponentManager->resolve<input::devices::ICamera>();
+	auto keyframesManager = xpcfComponentManager->resolve<storage::IKeyframesManager>();
+	auto mapper = xpcfComponentManager->resolve<solver::map::IMapper>();
+	auto tracking = xpcf::utils::dynamic_pointer_cast<SolARSLAMTracking>(xpcfComponentManager->resolve<slam::ITracking>());
+	if (!tracking) {
+		std::cerr << "The tracking component is not a SolARSLAMTracking" << std::endl;
+		return -1;
+	}
+	tracking->setCameraParameters(camera->getIntrinsicsParameters(), camera->getDistortionParameters());
+
+	if (mapper->loadFromFile() != FrameworkReturnCode::_SUCCESS) {
+		LOG_INFO("Cannot load map");
+		return 0;
+	}
+	std::vector<SRef<Keyframe>> keyframes;
+	keyframesManager->getAllKeyframes(keyframes);
+	if (keyframes.empty()) {
+		LOG_INFO("The map has no keyframe");
+		return 0;
+	}
+	std::sort(keyframes.begin(), keyframes.end(), [](const SRef<Keyframe> &k1, const SRef<Keyframe> &k2) { return k1->getId() < k2->getId(); });
+	LOG_INFO("Number of keyframes: {}", keyframes.size());
+	// the keyframes saved without their image are tracked with a blank image
+	Sizei resolution = camera->getResolution();
+	SRef<Image> blankImage = xpcf::utils::make_shared<Image>(resolution.width, resolution.height, Image::LAYOUT_BGR, Image::INTERLEAVED, Image::TYPE_8U);
+
+	std::vector<BenchmarkResult> results;
+	for (const auto &nbSessions : nbSessionsList)
+		results.push_back(benchmarkSessions(xpcfComponentManager, tracking, keyframes, blankImage, nbSessions, nbFramesPerSession));
+	saveResults(outputFileName, results);
+	std::cout << "Benchmark results saved to " << outputFileName << std::endl;
+
+	return 0;
+}